@@ -0,0 +1,200 @@
+#pragma once
+
+#include <chrono>
+#include <algorithm>
+#include <initializer_list>
+#include "ocl_wrapper.hpp"
+
+
+namespace oclw
+{
+	struct BatchPolicy
+	{
+		BatchPolicy(std::size_t max_jobs_ = 1024u, std::size_t max_elements_ = 1u << 20u, std::chrono::microseconds max_latency_ = std::chrono::microseconds(1000))
+			: max_jobs(max_jobs_)
+			, max_elements(max_elements_)
+			, max_latency(max_latency_)
+		{}
+
+		// The batch is flushed as soon as one of these limits is reached
+		std::size_t max_jobs;
+		std::size_t max_elements;
+		std::chrono::microseconds max_latency;
+	};
+
+
+	/*
+	Packs many small element-wise jobs running the same kernel into a single NDRange.
+	Inputs of all pending jobs are concatenated and the kernel is launched once per flush
+	with one work-item per element. The kernel must have the following arguments:
+
+		[0 .. inputs_count - 1] global input buffers (concatenated jobs' inputs)
+		[inputs_count]          global output buffer (concatenated jobs' outputs)
+		[inputs_count + 1]      global uint* offsets table, job j spans [offsets[j], offsets[j + 1])
+		[inputs_count + 2]      uint jobs count
+
+	Each job's output has the same number of elements as its inputs. Output containers must
+	stay alive until the batch containing them has been flushed.
+	*/
+	template<typename T>
+	class Batch
+	{
+	public:
+		Batch(Wrapper& wrapper, const Kernel& kernel, uint32_t inputs_count, const BatchPolicy& policy = BatchPolicy())
+			: m_wrapper(wrapper)
+			, m_kernel(kernel)
+			, m_policy(policy)
+			, m_inputs(inputs_count)
+			, m_input_buffers(inputs_count)
+			, m_capacity(0u)
+			, m_jobs_capacity(0u)
+		{
+			if (!inputs_count) {
+				throw Exception(CL_INVALID_VALUE, "Batch for kernel '" + m_kernel.getName() + "' needs at least one input");
+			}
+			m_offsets.push_back(0u);
+		}
+
+		void submit(std::initializer_list<const std::vector<T>*> inputs, std::vector<T>& output)
+		{
+			if (inputs.size() != m_inputs.size()) {
+				throw Exception(CL_INVALID_ARG_INDEX, "Batch job for kernel '" + m_kernel.getName() + "' has a wrong number of inputs");
+			}
+
+			const std::size_t elements_count = (*inputs.begin())->size();
+			for (const std::vector<T>* input : inputs) {
+				if (input->size() != elements_count) {
+					throw Exception(CL_INVALID_BUFFER_SIZE, "Batch job for kernel '" + m_kernel.getName() + "' has inputs of different sizes");
+				}
+			}
+
+			uint32_t input_index = 0u;
+			for (const std::vector<T>* input : inputs) {
+				std::vector<T>& packed = m_inputs[input_index++];
+				packed.insert(packed.end(), input->begin(), input->end());
+			}
+
+			if (m_outputs.empty()) {
+				m_oldest_submit = std::chrono::steady_clock::now();
+			}
+			m_outputs.push_back(&output);
+			m_offsets.push_back(m_offsets.back() + static_cast<uint32_t>(elements_count));
+
+			if (m_outputs.size() >= m_policy.max_jobs || m_offsets.back() >= m_policy.max_elements) {
+				flush();
+			}
+			else {
+				poll();
+			}
+		}
+
+		// Flushes the pending jobs if the oldest one has been waiting longer than the latency limit
+		bool poll()
+		{
+			if (!m_outputs.empty() && std::chrono::steady_clock::now() - m_oldest_submit >= m_policy.max_latency) {
+				flush();
+				return true;
+			}
+			return false;
+		}
+
+		void flush()
+		{
+			if (m_outputs.empty()) {
+				return;
+			}
+
+			const std::size_t jobs_count = m_outputs.size();
+			const std::size_t elements_count = m_offsets.back();
+			// Only empty jobs, nothing to launch
+			if (!elements_count) {
+				for (std::vector<T>* output : m_outputs) {
+					output->clear();
+				}
+				clear();
+				return;
+			}
+			reserve(elements_count, jobs_count);
+
+			// Upload packed inputs and offsets table, the queue is in order so writes don't need to block
+			for (std::size_t i(0); i < m_inputs.size(); ++i) {
+				m_wrapper.writeInMemoryObject(m_input_buffers[i], m_inputs[i].data(), elements_count * sizeof(T), false);
+			}
+			m_wrapper.writeInMemoryObject(m_offsets_buffer, m_offsets.data(), m_offsets.size() * sizeof(uint32_t), false);
+
+			const uint32_t inputs_count = static_cast<uint32_t>(m_inputs.size());
+			for (uint32_t i(0); i < inputs_count; ++i) {
+				m_kernel.setArgument(i, m_input_buffers[i]);
+			}
+			m_kernel.setArgument(inputs_count, m_output_buffer);
+			m_kernel.setArgument(inputs_count + 1, m_offsets_buffer);
+			m_kernel.setArgument(inputs_count + 2, static_cast<uint32_t>(jobs_count));
+
+			m_wrapper.runKernel(m_kernel, Size(elements_count));
+
+			m_results.resize(elements_count);
+			m_wrapper.readMemoryObject(m_output_buffer, m_results.data(), elements_count * sizeof(T));
+
+			// Scatter results back to each job's output
+			for (std::size_t j(0); j < jobs_count; ++j) {
+				std::vector<T>& output = *m_outputs[j];
+				output.assign(m_results.begin() + m_offsets[j], m_results.begin() + m_offsets[j + 1]);
+			}
+
+			clear();
+		}
+
+		std::size_t getPendingJobsCount() const
+		{
+			return m_outputs.size();
+		}
+
+		std::size_t getPendingElementsCount() const
+		{
+			return m_offsets.back();
+		}
+
+	private:
+		Wrapper& m_wrapper;
+		Kernel m_kernel;
+		BatchPolicy m_policy;
+
+		std::vector<std::vector<T>> m_inputs;
+		std::vector<std::vector<T>*> m_outputs;
+		std::vector<uint32_t> m_offsets;
+		std::vector<T> m_results;
+		std::chrono::steady_clock::time_point m_oldest_submit;
+
+		std::vector<MemoryObject> m_input_buffers;
+		MemoryObject m_output_buffer;
+		MemoryObject m_offsets_buffer;
+		std::size_t m_capacity;
+		std::size_t m_jobs_capacity;
+
+		void reserve(std::size_t elements_count, std::size_t jobs_count)
+		{
+			// Device buffers only grow so steady state flushes don't allocate
+			if (elements_count > m_capacity) {
+				m_capacity = std::max(elements_count, 2u * m_capacity);
+				for (MemoryObject& buffer : m_input_buffers) {
+					buffer = m_wrapper.createMemoryObject<T>(m_capacity, ReadOnly);
+				}
+				m_output_buffer = m_wrapper.createMemoryObject<T>(m_capacity, WriteOnly);
+			}
+
+			if (jobs_count > m_jobs_capacity) {
+				m_jobs_capacity = std::max(jobs_count, 2u * m_jobs_capacity);
+				m_offsets_buffer = m_wrapper.createMemoryObject<uint32_t>(m_jobs_capacity + 1u, ReadOnly);
+			}
+		}
+
+		void clear()
+		{
+			for (std::vector<T>& packed : m_inputs) {
+				packed.clear();
+			}
+			m_outputs.clear();
+			m_offsets.resize(1u);
+		}
+	};
+}
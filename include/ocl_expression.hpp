@@ -0,0 +1,343 @@
+#pragma once
+
+#include <map>
+#include <typeindex>
+#include <type_traits>
+#include "ocl_wrapper.hpp"
+
+
+namespace oclw
+{
+	/*
+	Compiles and caches one fused kernel per expression shape. The shape is the expression's
+	C++ type, so looking up an already compiled expression doesn't generate any source.
+	*/
+	class ExpressionEngine
+	{
+	public:
+		ExpressionEngine(Wrapper& wrapper)
+			: m_wrapper(wrapper)
+		{}
+
+		Wrapper& getWrapper()
+		{
+			return m_wrapper;
+		}
+
+		template<typename E>
+		Kernel& getKernel(const E& expression)
+		{
+			const std::type_index key(typeid(E));
+			auto it = m_kernels.find(key);
+			if (it == m_kernels.end()) {
+				// Only cached once built, a failed build is retried on the next use
+				CompiledExpression compiled;
+				compiled.program = m_wrapper.createProgram(generateSource(expression));
+				compiled.kernel = compiled.program.createKernel("oclw_expression");
+				return m_kernels.emplace(key, compiled).first->second.kernel;
+			}
+			return it->second.kernel;
+		}
+
+		std::size_t getCompiledExpressionsCount() const
+		{
+			return m_kernels.size();
+		}
+
+		template<typename E>
+		static std::string generateSource(const E& expression)
+		{
+			typedef typename E::value_type T;
+			std::stringstream params, body;
+			uint32_t arg_num = 0u;
+			expression.emit(params, body, arg_num);
+
+			std::stringstream source;
+			if (std::is_same<T, double>::value) {
+				source << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+			}
+			source << "__kernel void oclw_expression(__global " << TypeName<T>::get() << "* out" << params.str() << ", const uint n)\n"
+				<< "{\n"
+				<< "\tconst uint i = get_global_id(0);\n"
+				<< "\tif (i < n) {\n"
+				<< "\t\tout[i] = " << body.str() << ";\n"
+				<< "\t}\n"
+				<< "}\n";
+			return source.str();
+		}
+
+	private:
+		struct CompiledExpression
+		{
+			Program program;
+			Kernel kernel;
+		};
+
+		Wrapper& m_wrapper;
+		std::map<std::type_index, CompiledExpression> m_kernels;
+	};
+
+
+	template<typename E>
+	struct Expression
+	{
+		const E& self() const
+		{
+			return static_cast<const E&>(*this);
+		}
+	};
+
+
+	// Leaves are stored by reference, intermediate nodes are temporaries and are stored by value
+	template<typename E>
+	struct ExpressionStorage
+	{
+		typedef const E type;
+	};
+
+
+	template<typename T>
+	class Vector : public Expression<Vector<T>>
+	{
+		static_assert(TypeName<T>::known, "Vector element type has no OpenCL equivalent");
+
+	public:
+		typedef T value_type;
+
+		Vector(ExpressionEngine& engine, std::size_t size)
+			: m_engine(engine)
+			, m_buffer(engine.getWrapper().createMemoryObject<T>(size, ReadWrite))
+			, m_size(size)
+		{}
+
+		Vector(ExpressionEngine& engine, std::vector<T>& data)
+			: m_engine(engine)
+			, m_buffer(engine.getWrapper().createMemoryObject(data, ReadWrite | CopyHostPtr))
+			, m_size(data.size())
+		{}
+
+		// Vectors have value semantics, copies allocate their own buffer
+		Vector(const Vector& other)
+			: m_engine(other.m_engine)
+			, m_buffer(other.m_engine.getWrapper().template createMemoryObject<T>(other.m_size, ReadWrite))
+			, m_size(other.m_size)
+		{
+			assign(other);
+		}
+
+		Vector& operator=(const Vector& other)
+		{
+			return assign(other);
+		}
+
+		template<typename E>
+		Vector& operator=(const Expression<E>& expression)
+		{
+			return assign(expression.self());
+		}
+
+		void read(std::vector<T>& result)
+		{
+			m_engine.getWrapper().safeReadMemoryObject(m_buffer, result);
+		}
+
+		void write(const std::vector<T>& data)
+		{
+			if (data.size() != m_size) {
+				throw Exception(CL_INVALID_BUFFER_SIZE, "Cannot write vector, sizes don't match");
+			}
+			m_engine.getWrapper().writeInMemoryObject(m_buffer, data, true);
+		}
+
+		MemoryObject& getMemoryObject()
+		{
+			return m_buffer;
+		}
+
+		std::size_t size() const
+		{
+			return m_size;
+		}
+
+		void emit(std::ostream& params, std::ostream& body, uint32_t& arg_num) const
+		{
+			params << ", __global const " << TypeName<T>::get() << "* a" << arg_num;
+			body << "a" << arg_num << "[i]";
+			++arg_num;
+		}
+
+		void bind(Kernel& kernel, uint32_t& arg_num) const
+		{
+			kernel.setArgument(arg_num++, m_buffer);
+		}
+
+	private:
+		ExpressionEngine& m_engine;
+		mutable MemoryObject m_buffer;
+		const std::size_t m_size;
+
+		template<typename E>
+		Vector& assign(const E& expression)
+		{
+			if (expression.size() != m_size) {
+				throw Exception(CL_INVALID_BUFFER_SIZE, "Cannot assign expression, sizes don't match");
+			}
+
+			// Output, then expression leaves in emit order, then elements count
+			Kernel& kernel = m_engine.getKernel(expression);
+			uint32_t arg_num = 0u;
+			kernel.setArgument(arg_num++, m_buffer);
+			expression.bind(kernel, arg_num);
+			kernel.setArgument(arg_num, static_cast<cl_uint>(m_size));
+			m_engine.getWrapper().runKernel(kernel, Size(m_size));
+			return *this;
+		}
+	};
+
+
+	template<typename T>
+	struct ExpressionStorage<Vector<T>>
+	{
+		typedef const Vector<T>& type;
+	};
+
+
+	// Scalars are kernel arguments so changing their value doesn't change the expression's shape
+	template<typename T>
+	struct Scalar : public Expression<Scalar<T>>
+	{
+		typedef T value_type;
+
+		Scalar(T value_)
+			: value(value_)
+		{}
+
+		std::size_t size() const
+		{
+			return 0u;
+		}
+
+		void emit(std::ostream& params, std::ostream& body, uint32_t& arg_num) const
+		{
+			params << ", const " << TypeName<T>::get() << " s" << arg_num;
+			body << "s" << arg_num;
+			++arg_num;
+		}
+
+		void bind(Kernel& kernel, uint32_t& arg_num) const
+		{
+			kernel.setArgument(arg_num++, value);
+		}
+
+		const T value;
+	};
+
+
+	struct Add      { static const char* symbol() { return " + "; } };
+	struct Subtract { static const char* symbol() { return " - "; } };
+	struct Multiply { static const char* symbol() { return " * "; } };
+	struct Divide   { static const char* symbol() { return " / "; } };
+
+
+	template<typename Op, typename L, typename R>
+	struct BinaryExpression : public Expression<BinaryExpression<Op, L, R>>
+	{
+		typedef typename L::value_type value_type;
+
+		BinaryExpression(const L& left_, const R& right_)
+			: left(left_)
+			, right(right_)
+		{}
+
+		std::size_t size() const
+		{
+			const std::size_t left_size = left.size();
+			const std::size_t right_size = right.size();
+			if (left_size && right_size && left_size != right_size) {
+				throw Exception(CL_INVALID_BUFFER_SIZE, "Expression operands sizes don't match");
+			}
+			return left_size ? left_size : right_size;
+		}
+
+		void emit(std::ostream& params, std::ostream& body, uint32_t& arg_num) const
+		{
+			body << "(";
+			left.emit(params, body, arg_num);
+			body << Op::symbol();
+			right.emit(params, body, arg_num);
+			body << ")";
+		}
+
+		void bind(Kernel& kernel, uint32_t& arg_num) const
+		{
+			left.bind(kernel, arg_num);
+			right.bind(kernel, arg_num);
+		}
+
+		typename ExpressionStorage<L>::type left;
+		typename ExpressionStorage<R>::type right;
+	};
+
+
+	template<typename E>
+	struct NegateExpression : public Expression<NegateExpression<E>>
+	{
+		typedef typename E::value_type value_type;
+
+		NegateExpression(const E& operand_)
+			: operand(operand_)
+		{}
+
+		std::size_t size() const
+		{
+			return operand.size();
+		}
+
+		void emit(std::ostream& params, std::ostream& body, uint32_t& arg_num) const
+		{
+			body << "(-";
+			operand.emit(params, body, arg_num);
+			body << ")";
+		}
+
+		void bind(Kernel& kernel, uint32_t& arg_num) const
+		{
+			operand.bind(kernel, arg_num);
+		}
+
+		typename ExpressionStorage<E>::type operand;
+	};
+
+
+	template<typename E>
+	NegateExpression<E> operator-(const Expression<E>& operand)
+	{
+		return NegateExpression<E>(operand.self());
+	}
+
+
+#define OCLW_EXPRESSION_OPERATOR(op, Op)                                                                                   \
+	template<typename L, typename R>                                                                                       \
+	BinaryExpression<Op, L, R> operator op(const Expression<L>& left, const Expression<R>& right)                          \
+	{                                                                                                                      \
+		static_assert(std::is_same<typename L::value_type, typename R::value_type>::value, "Operands types don't match");  \
+		return BinaryExpression<Op, L, R>(left.self(), right.self());                                                      \
+	}                                                                                                                      \
+	template<typename L>                                                                                                   \
+	BinaryExpression<Op, L, Scalar<typename L::value_type>> operator op(const Expression<L>& left, typename L::value_type right) \
+	{                                                                                                                      \
+		return BinaryExpression<Op, L, Scalar<typename L::value_type>>(left.self(), Scalar<typename L::value_type>(right)); \
+	}                                                                                                                      \
+	template<typename R>                                                                                                   \
+	BinaryExpression<Op, Scalar<typename R::value_type>, R> operator op(typename R::value_type left, const Expression<R>& right) \
+	{                                                                                                                      \
+		return BinaryExpression<Op, Scalar<typename R::value_type>, R>(Scalar<typename R::value_type>(left), right.self()); \
+	}
+
+	OCLW_EXPRESSION_OPERATOR(+, Add)
+	OCLW_EXPRESSION_OPERATOR(-, Subtract)
+	OCLW_EXPRESSION_OPERATOR(*, Multiply)
+	OCLW_EXPRESSION_OPERATOR(/, Divide)
+
+#undef OCLW_EXPRESSION_OPERATOR
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstring>
+// F16C code paths are compiled for that target only and selected at runtime, the rest of the build stays baseline x86
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define OCLW_F16C_DISPATCH
+#include <immintrin.h>
+#endif
+#include "ocl_wrapper.hpp"
+
+
+namespace oclw
+{
+	// IEEE 754 binary16 conversions, vectorized with F16C when the CPU supports it
+	struct HalfConverter
+	{
+		static uint16_t toHalf(float value)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(float));
+			const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+			const uint32_t abs = bits & 0x7FFFFFFFu;
+
+			// Infinity and NaN, NaNs are quieted and keep the top of their payload
+			if (abs >= 0x7F800000u) {
+				return sign | 0x7C00u | (abs > 0x7F800000u ? static_cast<uint16_t>(0x0200u | ((abs >> 13) & 0x3FFu)) : 0u);
+			}
+			// Rounds to a value above the largest half (65504)
+			if (abs >= 0x477FF000u) {
+				return sign | 0x7C00u;
+			}
+			// Subnormal halves, rounded to nearest even
+			if (abs < 0x38800000u) {
+				if (abs < 0x33000000u) {
+					return sign;
+				}
+				const uint32_t shift = 126u - (abs >> 23);
+				const uint32_t mantissa = (abs & 0x7FFFFFu) | 0x800000u;
+				uint32_t half = mantissa >> shift;
+				const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+				const uint32_t halfway = 1u << (shift - 1u);
+				if (remainder > halfway || (remainder == halfway && (half & 1u))) {
+					++half;
+				}
+				return sign | static_cast<uint16_t>(half);
+			}
+			// Normal halves, rebias exponent and round to nearest even (a carry correctly bumps the exponent)
+			uint32_t half = (abs - 0x38000000u) >> 13;
+			const uint32_t remainder = abs & 0x1FFFu;
+			if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) {
+				++half;
+			}
+			return sign | static_cast<uint16_t>(half);
+		}
+
+		static float toFloat(uint16_t half)
+		{
+			const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+			uint32_t exponent = (half >> 10) & 0x1Fu;
+			uint32_t mantissa = half & 0x3FFu;
+			uint32_t bits;
+			if (exponent == 0x1Fu) {
+				bits = sign | 0x7F800000u | (mantissa ? 0x400000u | (mantissa << 13) : 0u);
+			}
+			else if (exponent) {
+				bits = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+			}
+			else if (mantissa) {
+				// Subnormal half, normalize it
+				exponent = 113u;
+				while (!(mantissa & 0x400u)) {
+					mantissa <<= 1;
+					--exponent;
+				}
+				bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+			}
+			else {
+				bits = sign;
+			}
+			float value;
+			std::memcpy(&value, &bits, sizeof(float));
+			return value;
+		}
+
+		static void compress(const float* source, uint16_t* destination, std::size_t count)
+		{
+			std::size_t i = 0u;
+#if defined(OCLW_F16C_DISPATCH)
+			if (hasF16C()) {
+				i = compressF16C(source, destination, count);
+			}
+#endif
+			for (; i < count; ++i) {
+				destination[i] = toHalf(source[i]);
+			}
+		}
+
+		static void expand(const uint16_t* source, float* destination, std::size_t count)
+		{
+			std::size_t i = 0u;
+#if defined(OCLW_F16C_DISPATCH)
+			if (hasF16C()) {
+				i = expandF16C(source, destination, count);
+			}
+#endif
+			for (; i < count; ++i) {
+				destination[i] = toFloat(source[i]);
+			}
+		}
+
+#if defined(OCLW_F16C_DISPATCH)
+		static bool hasF16C()
+		{
+			static const bool supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+			return supported;
+		}
+
+	private:
+		// Convert full blocks of 8 values and return how many were converted
+		__attribute__((target("avx,f16c")))
+		static std::size_t compressF16C(const float* source, uint16_t* destination, std::size_t count)
+		{
+			std::size_t i = 0u;
+			for (; i + 8u <= count; i += 8u) {
+				const __m256 values = _mm256_loadu_ps(source + i);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+			}
+			return i;
+		}
+
+		__attribute__((target("avx,f16c")))
+		static std::size_t expandF16C(const uint16_t* source, float* destination, std::size_t count)
+		{
+			std::size_t i = 0u;
+			for (; i + 8u <= count; i += 8u) {
+				const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+				_mm256_storeu_ps(destination + i, _mm256_cvtph_ps(values));
+			}
+			return i;
+		}
+#endif
+	};
+
+
+	/*
+	Moves float buffers over the bus as fp16, halving the transferred bytes. Data is compressed
+	on the host and expanded on the device with vload_half (and the other way around for reads),
+	which is core OpenCL and doesn't require cl_khr_fp16. Values are rounded to 11 significant bits
+	and values beyond the half range (+-65504) become infinities.
+	*/
+	class HalfTransfer
+	{
+	public:
+		HalfTransfer(Wrapper& wrapper)
+			: m_wrapper(wrapper)
+			, m_capacity(0u)
+		{}
+
+		void write(MemoryObject& object, const std::vector<float>& data)
+		{
+			const std::size_t count = data.size();
+			if (count * sizeof(float) > object.getBytesSize()) {
+				throw Exception(CL_INVALID_BUFFER_SIZE, "Cannot write half data, buffer is too small");
+			}
+			if (!count) {
+				return;
+			}
+			prepare(count);
+
+			m_host_staging.resize(count);
+			HalfConverter::compress(data.data(), m_host_staging.data(), count);
+			m_wrapper.writeInMemoryObject(m_device_staging, m_host_staging.data(), count * sizeof(uint16_t), false);
+
+			m_expand.setArgument(0, m_device_staging);
+			m_expand.setArgument(1, object);
+			m_expand.setArgument(2, static_cast<cl_uint>(count));
+			m_wrapper.runKernel(m_expand, Size(count));
+		}
+
+		void read(MemoryObject& object, std::vector<float>& result)
+		{
+			const std::size_t count = object.getBytesSize() / sizeof(float);
+			if (!count) {
+				result.clear();
+				return;
+			}
+			prepare(count);
+
+			m_compress.setArgument(0, object);
+			m_compress.setArgument(1, m_device_staging);
+			m_compress.setArgument(2, static_cast<cl_uint>(count));
+			m_wrapper.runKernel(m_compress, Size(count));
+
+			m_host_staging.resize(count);
+			m_wrapper.readMemoryObject(m_device_staging, m_host_staging.data(), count * sizeof(uint16_t));
+			result.resize(count);
+			HalfConverter::expand(m_host_staging.data(), result.data(), count);
+		}
+
+	private:
+		Wrapper& m_wrapper;
+		Program m_program;
+		Kernel m_expand;
+		Kernel m_compress;
+		MemoryObject m_device_staging;
+		std::vector<uint16_t> m_host_staging;
+		std::size_t m_capacity;
+
+		static const char* getSource()
+		{
+			return
+				"__kernel void oclw_expand_half(__global const half* source, __global float* destination, const uint n)\n"
+				"{\n"
+				"\tconst uint i = get_global_id(0);\n"
+				"\tif (i < n) {\n"
+				"\t\tdestination[i] = vload_half(i, source);\n"
+				"\t}\n"
+				"}\n"
+				"__kernel void oclw_compress_half(__global const float* source, __global half* destination, const uint n)\n"
+				"{\n"
+				"\tconst uint i = get_global_id(0);\n"
+				"\tif (i < n) {\n"
+				"\t\tvstore_half_rte(source[i], i, destination);\n"
+				"\t}\n"
+				"}\n";
+		}
+
+		void prepare(std::size_t count)
+		{
+			if (!m_program) {
+				m_program = m_wrapper.createProgram(getSource());
+				m_expand = m_program.createKernel("oclw_expand_half");
+				m_compress = m_program.createKernel("oclw_compress_half");
+			}
+			// Staging buffer only grows
+			if (count > m_capacity) {
+				m_capacity = count;
+				m_device_staging = m_wrapper.createMemoryObject<uint16_t>(m_capacity, ReadWrite);
+			}
+		}
+	};
+}
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <map>
+#include <cstring>
+#include <initializer_list>
+#include "ocl_wrapper.hpp"
+
+
+namespace oclw
+{
+	struct ManagedBuffer
+	{
+		uint64_t id = 0u;
+
+		operator bool() const
+		{
+			return id != 0u;
+		}
+	};
+
+
+	struct ManagedArgument
+	{
+		uint32_t arg_num;
+		ManagedBuffer buffer;
+	};
+
+
+	/*
+	Keeps device allocations under a budget (90% of CL_DEVICE_GLOBAL_MEM_SIZE by default).
+	When a buffer needs to be resident and the budget is reached, least recently used buffers
+	are copied back to host memory and released, they are restored on their next use.
+	Buffers must be bound through the manager (runKernel or acquire) before each launch since
+	an evicted buffer's cl_mem doesn't exist anymore. Allocations made outside the manager
+	(images for instance) can be accounted for with reserve and unreserve.
+	*/
+	class MemoryManager
+	{
+	public:
+		MemoryManager(Wrapper& wrapper, uint64_t budget = 0u)
+			: m_wrapper(wrapper)
+			, m_budget(budget)
+			, m_resident_bytes(0u)
+			, m_reserved_bytes(0u)
+			, m_next_id(1u)
+			, m_clock(0u)
+			, m_evictions_count(0u)
+			, m_restores_count(0u)
+		{
+			if (!m_budget) {
+				m_budget = Utils::getDeviceInfo<cl_ulong>(wrapper.getDevice(), CL_DEVICE_GLOBAL_MEM_SIZE) / 10u * 9u;
+			}
+		}
+
+		template<typename T>
+		ManagedBuffer create(std::size_t element_count, int32_t mode = oclw::ReadWrite)
+		{
+			return createBuffer(sizeof(T), element_count, mode, nullptr);
+		}
+
+		template<typename T>
+		ManagedBuffer create(const std::vector<T>& data, int32_t mode = oclw::ReadWrite)
+		{
+			return createBuffer(sizeof(T), data.size(), mode, data.data());
+		}
+
+		void release(ManagedBuffer buffer)
+		{
+			Entry& entry = getEntry(buffer);
+			if (entry.resident) {
+				m_resident_bytes -= entry.bytes_size;
+			}
+			m_entries.erase(buffer.id);
+		}
+
+		// Makes the buffer resident and marks it as used, the returned object is valid until the buffer is evicted
+		MemoryObject& acquire(ManagedBuffer buffer)
+		{
+			Entry& entry = getEntry(buffer);
+			if (!entry.resident) {
+				allocate(entry, entry.host_copy.data());
+				entry.host_copy.clear();
+				entry.host_copy.shrink_to_fit();
+				++m_restores_count;
+			}
+			entry.last_use = ++m_clock;
+			return entry.object;
+		}
+
+		// Pinned buffers are never evicted
+		void pin(ManagedBuffer buffer)
+		{
+			++getEntry(buffer).pins_count;
+		}
+
+		void unpin(ManagedBuffer buffer)
+		{
+			Entry& entry = getEntry(buffer);
+			if (entry.pins_count) {
+				--entry.pins_count;
+			}
+		}
+
+		void runKernel(Kernel& kernel, const Size& global_size, const Size& local_size, std::initializer_list<ManagedArgument> arguments)
+		{
+			bindArguments(kernel, arguments);
+			try {
+				launch(kernel, global_size, &local_size, getArgumentsBytes(arguments));
+			}
+			catch (const Exception&) {
+				unpinArguments(arguments);
+				throw;
+			}
+			unpinArguments(arguments);
+		}
+
+		void runKernel(Kernel& kernel, const Size& global_size, std::initializer_list<ManagedArgument> arguments)
+		{
+			bindArguments(kernel, arguments);
+			try {
+				launch(kernel, global_size, nullptr, getArgumentsBytes(arguments));
+			}
+			catch (const Exception&) {
+				unpinArguments(arguments);
+				throw;
+			}
+			unpinArguments(arguments);
+		}
+
+		template<typename T>
+		void read(ManagedBuffer buffer, std::vector<T>& result)
+		{
+			Entry& entry = getEntry(buffer);
+			if (entry.bytes_size % sizeof(T)) {
+				throw Exception(CL_INVALID_BUFFER_SIZE, "Cannot read managed buffer, its size isn't a multiple of the element size");
+			}
+			result.resize(entry.bytes_size / sizeof(T));
+			if (entry.resident) {
+				m_wrapper.readMemoryObject(entry.object, result.data(), entry.bytes_size);
+			}
+			else {
+				std::memcpy(result.data(), entry.host_copy.data(), entry.bytes_size);
+			}
+		}
+
+		// Writes to an evicted buffer only update its host copy
+		template<typename T>
+		void write(ManagedBuffer buffer, const std::vector<T>& data)
+		{
+			Entry& entry = getEntry(buffer);
+			if (data.size() * sizeof(T) != entry.bytes_size) {
+				throw Exception(CL_INVALID_BUFFER_SIZE, "Cannot write in managed buffer, sizes don't match");
+			}
+			if (entry.resident) {
+				m_wrapper.writeInMemoryObject(entry.object, data.data(), entry.bytes_size, true);
+			}
+			else {
+				std::memcpy(entry.host_copy.data(), data.data(), entry.bytes_size);
+			}
+		}
+
+		void evict(ManagedBuffer buffer)
+		{
+			Entry& entry = getEntry(buffer);
+			if (entry.resident) {
+				evict(entry);
+			}
+		}
+
+		bool isResident(ManagedBuffer buffer)
+		{
+			return getEntry(buffer).resident;
+		}
+
+		void reserve(uint64_t bytes_size)
+		{
+			makeRoom(bytes_size);
+			m_reserved_bytes += bytes_size;
+		}
+
+		void unreserve(uint64_t bytes_size)
+		{
+			m_reserved_bytes -= std::min(bytes_size, m_reserved_bytes);
+		}
+
+		uint64_t getBudget() const
+		{
+			return m_budget;
+		}
+
+		uint64_t getResidentBytes() const
+		{
+			return m_resident_bytes + m_reserved_bytes;
+		}
+
+		uint64_t getEvictionsCount() const
+		{
+			return m_evictions_count;
+		}
+
+		uint64_t getRestoresCount() const
+		{
+			return m_restores_count;
+		}
+
+	private:
+		struct Entry
+		{
+			uint64_t id;
+			MemoryObject object;
+			std::vector<uint8_t> host_copy;
+			uint32_t element_size;
+			uint64_t element_count;
+			uint64_t bytes_size;
+			int32_t mode;
+			uint64_t last_use;
+			uint32_t pins_count;
+			bool resident;
+		};
+
+		Wrapper& m_wrapper;
+		uint64_t m_budget;
+		uint64_t m_resident_bytes;
+		uint64_t m_reserved_bytes;
+		uint64_t m_next_id;
+		uint64_t m_clock;
+		uint64_t m_evictions_count;
+		uint64_t m_restores_count;
+		std::map<uint64_t, Entry> m_entries;
+
+		ManagedBuffer createBuffer(uint32_t element_size, uint64_t element_count, int32_t mode, const void* data)
+		{
+			Entry& entry = createEntry(element_size, element_count, mode);
+			try {
+				allocate(entry, data);
+			}
+			catch (const Exception&) {
+				m_entries.erase(entry.id);
+				throw;
+			}
+			ManagedBuffer buffer;
+			buffer.id = entry.id;
+			return buffer;
+		}
+
+		Entry& createEntry(uint32_t element_size, uint64_t element_count, int32_t mode)
+		{
+			const uint64_t id = m_next_id++;
+			Entry& entry = m_entries[id];
+			entry.id = id;
+			entry.element_size = element_size;
+			entry.element_count = element_count;
+			entry.bytes_size = element_size * element_count;
+			// Initial data is always written explicitly
+			entry.mode = mode & ~CopyHostPtr;
+			entry.last_use = ++m_clock;
+			entry.pins_count = 0u;
+			entry.resident = false;
+			return entry;
+		}
+
+		Entry& getEntry(ManagedBuffer buffer)
+		{
+			auto it = m_entries.find(buffer.id);
+			if (it == m_entries.end()) {
+				throw Exception(CL_INVALID_MEM_OBJECT, "Unknown managed buffer");
+			}
+			return it->second;
+		}
+
+		void allocate(Entry& entry, const void* data)
+		{
+			// Pin while making room so the entry can't evict itself
+			++entry.pins_count;
+			try {
+				makeRoom(entry.bytes_size);
+				while (!tryAllocate(entry, data)) {}
+			}
+			catch (const Exception&) {
+				--entry.pins_count;
+				throw;
+			}
+			--entry.pins_count;
+			entry.resident = true;
+			m_resident_bytes += entry.bytes_size;
+		}
+
+		bool tryAllocate(Entry& entry, const void* data)
+		{
+			try {
+				entry.object = MemoryObject(m_wrapper.getContext(), entry.element_size, entry.element_count, entry.mode);
+				if (data) {
+					m_wrapper.writeInMemoryObject(entry.object, data, entry.bytes_size, true);
+				}
+				return true;
+			}
+			catch (const Exception& error) {
+				// The budget was too optimistic, free some more memory and retry
+				if (!isOutOfMemory(error.getErrorCode()) || !evictLeastRecentlyUsed()) {
+					throw;
+				}
+				return false;
+			}
+		}
+
+		/*
+		Drivers usually allocate on first use, so running out of memory is often reported at enqueue time.
+		Allocation failures evict until the launch succeeds or nothing is left to evict. CL_OUT_OF_RESOURCES
+		is also returned for launches that can never succeed (registers, local size...) so it is retried
+		only once, after freeing at least the size of the launch's arguments.
+		*/
+		void launch(Kernel& kernel, const Size& global_size, const Size* local_size, uint64_t arguments_bytes)
+		{
+			bool out_of_resources_retried = false;
+			while (true) {
+				try {
+					if (local_size) {
+						m_wrapper.runKernel(kernel, global_size, *local_size);
+					}
+					else {
+						m_wrapper.runKernel(kernel, global_size);
+					}
+					return;
+				}
+				catch (const Exception& error) {
+					// Arguments are pinned, only other buffers are evicted
+					const cl_int err_num = error.getErrorCode();
+					if (err_num == CL_MEM_OBJECT_ALLOCATION_FAILURE && evictLeastRecentlyUsed()) {
+						continue;
+					}
+					if (err_num == CL_OUT_OF_RESOURCES && !out_of_resources_retried && evictBytes(arguments_bytes)) {
+						out_of_resources_retried = true;
+						continue;
+					}
+					throw;
+				}
+			}
+		}
+
+		// Returns false if nothing could be evicted
+		bool evictBytes(uint64_t bytes_size)
+		{
+			const uint64_t initial_resident_bytes = m_resident_bytes;
+			while (initial_resident_bytes - m_resident_bytes < bytes_size && evictLeastRecentlyUsed()) {}
+			return m_resident_bytes < initial_resident_bytes;
+		}
+
+		uint64_t getArgumentsBytes(std::initializer_list<ManagedArgument> arguments)
+		{
+			uint64_t bytes_size = 0u;
+			for (const ManagedArgument& argument : arguments) {
+				bytes_size += getEntry(argument.buffer).bytes_size;
+			}
+			return bytes_size;
+		}
+
+		static bool isOutOfMemory(cl_int err_num)
+		{
+			return err_num == CL_MEM_OBJECT_ALLOCATION_FAILURE || err_num == CL_OUT_OF_RESOURCES;
+		}
+
+		void makeRoom(uint64_t bytes_size)
+		{
+			while (getResidentBytes() + bytes_size > m_budget) {
+				if (!evictLeastRecentlyUsed()) {
+					throw Exception(CL_MEM_OBJECT_ALLOCATION_FAILURE, "Device memory budget exceeded by pinned buffers");
+				}
+			}
+		}
+
+		bool evictLeastRecentlyUsed()
+		{
+			Entry* lru = nullptr;
+			for (auto& it : m_entries) {
+				Entry& entry = it.second;
+				if (entry.resident && !entry.pins_count && (!lru || entry.last_use < lru->last_use)) {
+					lru = &entry;
+				}
+			}
+			if (lru) {
+				evict(*lru);
+				return true;
+			}
+			return false;
+		}
+
+		void evict(Entry& entry)
+		{
+			entry.host_copy.resize(entry.bytes_size);
+			m_wrapper.readMemoryObject(entry.object, entry.host_copy.data(), entry.bytes_size);
+			entry.object = MemoryObject();
+			entry.resident = false;
+			m_resident_bytes -= entry.bytes_size;
+			++m_evictions_count;
+		}
+
+		void bindArguments(Kernel& kernel, std::initializer_list<ManagedArgument> arguments)
+		{
+			// Arguments are pinned as they are restored so they don't evict each other
+			std::vector<ManagedBuffer> pinned;
+			try {
+				for (const ManagedArgument& argument : arguments) {
+					MemoryObject& object = acquire(argument.buffer);
+					pin(argument.buffer);
+					pinned.push_back(argument.buffer);
+					kernel.setArgument(argument.arg_num, object);
+				}
+			}
+			catch (const Exception&) {
+				for (ManagedBuffer buffer : pinned) {
+					unpin(buffer);
+				}
+				throw;
+			}
+		}
+
+		void unpinArguments(std::initializer_list<ManagedArgument> arguments)
+		{
+			for (const ManagedArgument& argument : arguments) {
+				unpin(argument.buffer);
+			}
+		}
+	};
+}
@@ -0,0 +1,642 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include "ocl_wrapper.hpp"
+
+
+namespace oclw
+{
+	struct PipelineBuffer
+	{
+		uint32_t id;
+	};
+
+
+	enum class PipelineAccess
+	{
+		Read,
+		Write,
+		ReadWrite
+	};
+
+
+	struct PipelineArgument
+	{
+		uint32_t arg_num;
+		PipelineBuffer buffer;
+		PipelineAccess access;
+	};
+
+
+	/*
+	Runs a DAG of stages (uploads, kernels, downloads and host callbacks) declared once and
+	submitted once per frame. Dependencies are deduced from the buffers each stage reads and
+	writes in declaration order, and are enforced with events so independent stages overlap
+	across queues: uploads, downloads and kernels get their own queues and independent kernel
+	chains are spread over the compute queues (queues_count - 2, the default is 2 compute queues,
+	with fewer than 3 queues kernels share the download queue). Intermediate buffers whose lifetimes don't
+	overlap share the same device allocation, and each of the frames in flight has its own set
+	of allocations so frame N + 1 is uploaded while frame N is still computing.
+	Host stages run on the calling thread, in submission order, from poll, isComplete and wait.
+	*/
+	class Pipeline
+	{
+	public:
+		Pipeline(Wrapper& wrapper, uint32_t frames_in_flight = 2u, uint32_t queues_count = 4u)
+			: m_wrapper(wrapper)
+			, m_frames(std::max(frames_in_flight, 1u))
+			, m_next_frame(0u)
+			, m_compiled(false)
+		{
+			const uint32_t count = std::max(queues_count, 1u);
+			for (uint32_t i(0); i < count; ++i) {
+				m_queues.push_back(wrapper.getContext().createQueue(wrapper.getDevice()));
+			}
+			// Uploads on the first queue, downloads on the last one, kernels in between when there are enough queues
+			m_upload_queue = 0u;
+			m_download_queue = count - 1u;
+			for (uint32_t i(1); i + 1u < count; ++i) {
+				m_compute_queues.push_back(i);
+			}
+			if (m_compute_queues.empty()) {
+				m_compute_queues.push_back(m_download_queue);
+			}
+		}
+
+		~Pipeline()
+		{
+			// Host stages that never ran are aborted so the commands waiting for them don't block the queues
+			for (HostTask& task : m_host_tasks) {
+				clSetUserEventStatus(task.user_event.getRaw(), CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST);
+			}
+			for (CommandQueue& queue : m_queues) {
+				queue.waitCompletion();
+			}
+		}
+
+		template<typename T>
+		PipelineBuffer addBuffer(std::size_t element_count)
+		{
+			return addBuffer(element_count * sizeof(T));
+		}
+
+		// Device buffer owned by the pipeline, it may share its memory with other buffers
+		PipelineBuffer addBuffer(std::size_t bytes_size)
+		{
+			checkNotCompiled();
+			VirtualBuffer buffer;
+			buffer.bytes_size = bytes_size;
+			buffer.external = false;
+			m_buffers.push_back(buffer);
+			return PipelineBuffer{ static_cast<uint32_t>(m_buffers.size() - 1u) };
+		}
+
+		// Buffer shared by all frames (weights, lookup tables...), stages can only read it
+		PipelineBuffer addExternalBuffer(MemoryObject& object)
+		{
+			checkNotCompiled();
+			VirtualBuffer buffer;
+			buffer.bytes_size = object.getBytesSize();
+			buffer.external = true;
+			buffer.object = object;
+			m_buffers.push_back(buffer);
+			return PipelineBuffer{ static_cast<uint32_t>(m_buffers.size() - 1u) };
+		}
+
+		// source is called at submit time and must stay valid until the frame completes
+		uint32_t addUpload(PipelineBuffer buffer, std::function<const void*(uint64_t frame)> source)
+		{
+			Stage stage(StageType::Upload);
+			stage.arguments.push_back({ 0u, buffer, PipelineAccess::Write });
+			stage.source = source;
+			return addStage(stage);
+		}
+
+		uint32_t addKernel(Kernel& kernel, const Size& global_size, std::initializer_list<PipelineArgument> arguments, std::function<void(Kernel&, uint64_t frame)> configure = nullptr)
+		{
+			Stage stage(StageType::Kernel);
+			stage.kernel = kernel;
+			stage.dimension = global_size.dimension;
+			std::copy(global_size.sizes, global_size.sizes + 3, stage.global_size);
+			stage.arguments = arguments;
+			stage.configure = configure;
+			return addStage(stage);
+		}
+
+		uint32_t addKernel(Kernel& kernel, const Size& global_size, const Size& local_size, std::initializer_list<PipelineArgument> arguments, std::function<void(Kernel&, uint64_t frame)> configure = nullptr)
+		{
+			Stage stage(StageType::Kernel);
+			stage.kernel = kernel;
+			stage.dimension = global_size.dimension;
+			std::copy(global_size.sizes, global_size.sizes + 3, stage.global_size);
+			std::copy(local_size.sizes, local_size.sizes + 3, stage.local_size);
+			stage.has_local_size = true;
+			stage.arguments = arguments;
+			stage.configure = configure;
+			return addStage(stage);
+		}
+
+		// destination is called at submit time and must stay valid until the frame completes
+		uint32_t addDownload(PipelineBuffer buffer, std::function<void*(uint64_t frame)> destination)
+		{
+			Stage stage(StageType::Download);
+			stage.arguments.push_back({ 0u, buffer, PipelineAccess::Read });
+			stage.destination = destination;
+			return addStage(stage);
+		}
+
+		// Host stages don't touch device buffers, they run once the listed stages are complete
+		uint32_t addHostStage(std::function<void(uint64_t frame)> callback, std::initializer_list<uint32_t> after)
+		{
+			Stage stage(StageType::Host);
+			stage.callback = callback;
+			const uint32_t stage_id = addStage(stage);
+			for (uint32_t dependency : after) {
+				addDependency(stage_id, dependency);
+			}
+			return stage_id;
+		}
+
+		// Orders two stages that don't share buffers, for instance a kernel after a host stage
+		void addDependency(uint32_t stage, uint32_t after)
+		{
+			checkNotCompiled();
+			if (stage >= m_stages.size() || after >= stage) {
+				throw Exception(CL_INVALID_VALUE, "Pipeline stages can only depend on stages declared before them");
+			}
+			m_stages[stage].dependencies.push_back(after);
+		}
+
+		// Called by the first submit, can be called earlier to allocate buffers up front
+		void compile()
+		{
+			if (m_compiled) {
+				return;
+			}
+			computeLifetimes();
+			computeDependencies();
+			assignPhysicalBuffers();
+			assignComputeLanes();
+
+			for (Stage& stage : m_stages) {
+				std::sort(stage.dependencies.begin(), stage.dependencies.end());
+				stage.dependencies.erase(std::unique(stage.dependencies.begin(), stage.dependencies.end()), stage.dependencies.end());
+			}
+			for (FrameState& frame : m_frames) {
+				for (std::size_t bytes_size : m_physical_sizes) {
+					frame.objects.push_back(m_wrapper.createMemoryObject<uint8_t>(bytes_size, ReadWrite));
+				}
+			}
+			m_compiled = true;
+		}
+
+		// Enqueues a frame and returns its index, waits for the oldest frame if all slots are in flight
+		uint64_t submit()
+		{
+			compile();
+			const uint64_t frame_index = m_next_frame;
+			if (frame_index >= m_frames.size()) {
+				wait(frame_index - m_frames.size());
+			}
+			FrameState& frame = m_frames[frame_index % m_frames.size()];
+			frame.index = frame_index;
+			frame.events.assign(m_stages.size(), Event());
+			frame.pending = true;
+			++m_next_frame;
+
+			const std::size_t host_tasks_count = m_host_tasks.size();
+			try {
+				for (uint32_t i(0); i < m_stages.size(); ++i) {
+					frame.events[i] = enqueue(m_stages[i], frame);
+				}
+			}
+			catch (const Exception&) {
+				// Host stages of the partially enqueued frame will never run
+				while (m_host_tasks.size() > host_tasks_count) {
+					m_host_tasks.back().user_event.setComplete(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST);
+					m_host_tasks.pop_back();
+				}
+				// Stages already enqueued still use the slot's buffers, it can't be reused before they are done.
+				// Those waiting for the aborted host stages fail, so errors are ignored here
+				for (CommandQueue& queue : m_queues) {
+					queue.flush();
+				}
+				for (const Event& event : frame.events) {
+					if (event) {
+						clWaitForEvents(1, &event.getRaw());
+					}
+				}
+				frame.events.clear();
+				frame.pending = false;
+				throw;
+			}
+			for (CommandQueue& queue : m_queues) {
+				queue.flush();
+			}
+			return frame_index;
+		}
+
+		// Runs the host stages that are ready without blocking
+		void poll()
+		{
+			while (!m_host_tasks.empty() && isReady(m_host_tasks.front())) {
+				runHostTask();
+			}
+		}
+
+		bool isComplete(uint64_t frame_index)
+		{
+			poll();
+			const FrameState& frame = m_frames[frame_index % m_frames.size()];
+			if (frame_index >= m_next_frame) {
+				return false;
+			}
+			if (frame.index != frame_index || !frame.pending) {
+				return true;
+			}
+			for (const Event& event : frame.events) {
+				if (!event.isComplete()) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void wait(uint64_t frame_index)
+		{
+			if (frame_index >= m_next_frame) {
+				throw Exception(CL_INVALID_VALUE, "Cannot wait for a frame that wasn't submitted");
+			}
+			FrameState& frame = m_frames[frame_index % m_frames.size()];
+			// Older frames using the same slot were waited for before it was reused
+			if (frame.index != frame_index || !frame.pending) {
+				return;
+			}
+			// Host stages are queued in submission order so earlier frames' ones run first
+			while (!m_host_tasks.empty() && m_host_tasks.front().frame_index <= frame_index) {
+				runHostTask();
+			}
+			frame.pending = false;
+			const std::vector<Event> events = std::move(frame.events);
+			frame.events.clear();
+			for (const Event& event : events) {
+				event.wait();
+			}
+		}
+
+		void finish()
+		{
+			const uint64_t first = m_next_frame > m_frames.size() ? m_next_frame - m_frames.size() : 0u;
+			for (uint64_t frame_index(first); frame_index < m_next_frame; ++frame_index) {
+				wait(frame_index);
+			}
+		}
+
+		std::size_t getStagesCount() const
+		{
+			return m_stages.size();
+		}
+
+		const std::vector<uint32_t>& getDependencies(uint32_t stage)
+		{
+			compile();
+			return m_stages[stage].dependencies;
+		}
+
+		// Bytes of the pipeline owned buffers as declared
+		uint64_t getDeclaredBytes() const
+		{
+			uint64_t bytes = 0u;
+			for (const VirtualBuffer& buffer : m_buffers) {
+				bytes += buffer.external ? 0u : buffer.bytes_size;
+			}
+			return bytes;
+		}
+
+		// Bytes actually allocated for one frame after lifetime based sharing
+		uint64_t getAllocatedBytesPerFrame() const
+		{
+			uint64_t bytes = 0u;
+			for (std::size_t bytes_size : m_physical_sizes) {
+				bytes += bytes_size;
+			}
+			return bytes;
+		}
+
+	private:
+		enum class StageType
+		{
+			Upload,
+			Kernel,
+			Download,
+			Host
+		};
+
+		struct Stage
+		{
+			Stage(StageType type_)
+				: type(type_)
+				, dimension(0u)
+				, global_size{ 0, 0, 0 }
+				, local_size{ 0, 0, 0 }
+				, has_local_size(false)
+				, lane(0u)
+			{}
+
+			StageType type;
+			Kernel kernel;
+			uint32_t dimension;
+			std::size_t global_size[3];
+			std::size_t local_size[3];
+			bool has_local_size;
+			// Transfers have a single argument, the transferred buffer
+			std::vector<PipelineArgument> arguments;
+			std::function<void(Kernel&, uint64_t)> configure;
+			std::function<const void*(uint64_t)> source;
+			std::function<void*(uint64_t)> destination;
+			std::function<void(uint64_t)> callback;
+			std::vector<uint32_t> dependencies;
+			uint32_t lane;
+		};
+
+		static constexpr uint32_t Unused = ~0u;
+
+		struct VirtualBuffer
+		{
+			std::size_t bytes_size;
+			bool external;
+			MemoryObject object;
+			uint32_t first_use = Unused;
+			uint32_t last_use = Unused;
+			uint32_t physical = Unused;
+		};
+
+		struct FrameState
+		{
+			uint64_t index = 0u;
+			bool pending = false;
+			std::vector<Event> events;
+			std::vector<MemoryObject> objects;
+		};
+
+		struct HostTask
+		{
+			uint64_t frame_index;
+			uint32_t stage;
+			Event user_event;
+			std::vector<Event> wait_list;
+		};
+
+		Wrapper& m_wrapper;
+		std::vector<CommandQueue> m_queues;
+		uint32_t m_upload_queue;
+		uint32_t m_download_queue;
+		std::vector<uint32_t> m_compute_queues;
+		std::vector<Stage> m_stages;
+		std::vector<VirtualBuffer> m_buffers;
+		std::vector<std::size_t> m_physical_sizes;
+		std::vector<FrameState> m_frames;
+		std::deque<HostTask> m_host_tasks;
+		uint64_t m_next_frame;
+		bool m_compiled;
+
+		void checkNotCompiled() const
+		{
+			if (m_compiled) {
+				throw Exception(CL_INVALID_OPERATION, "Pipeline cannot be modified after it is compiled");
+			}
+		}
+
+		uint32_t addStage(const Stage& stage)
+		{
+			checkNotCompiled();
+			for (const PipelineArgument& argument : stage.arguments) {
+				if (argument.buffer.id >= m_buffers.size()) {
+					throw Exception(CL_INVALID_VALUE, "Pipeline stage uses an unknown buffer");
+				}
+				if (m_buffers[argument.buffer.id].external && argument.access != PipelineAccess::Read) {
+					throw Exception(CL_INVALID_VALUE, "External pipeline buffers are shared by all frames and can only be read");
+				}
+			}
+			m_stages.push_back(stage);
+			return static_cast<uint32_t>(m_stages.size() - 1u);
+		}
+
+		static bool isWrite(PipelineAccess access)
+		{
+			return access != PipelineAccess::Read;
+		}
+
+		void computeLifetimes()
+		{
+			for (uint32_t i(0); i < m_stages.size(); ++i) {
+				for (const PipelineArgument& argument : m_stages[i].arguments) {
+					VirtualBuffer& buffer = m_buffers[argument.buffer.id];
+					if (buffer.external) {
+						continue;
+					}
+					if (buffer.first_use == Unused) {
+						// Content doesn't survive between frames nor through shared memory
+						if (argument.access != PipelineAccess::Write) {
+							throw Exception(CL_INVALID_OPERATION, "Pipeline buffers must be written by the first stage using them");
+						}
+						buffer.first_use = i;
+					}
+					buffer.last_use = i;
+				}
+			}
+		}
+
+		// Read after write, write after write and write after read hazards in declaration order
+		void computeDependencies()
+		{
+			std::vector<uint32_t> last_writer(m_buffers.size(), static_cast<uint32_t>(Unused));
+			std::vector<std::vector<uint32_t>> readers(m_buffers.size());
+			for (uint32_t i(0); i < m_stages.size(); ++i) {
+				Stage& stage = m_stages[i];
+				for (const PipelineArgument& argument : stage.arguments) {
+					const uint32_t id = argument.buffer.id;
+					if (last_writer[id] != Unused && last_writer[id] != i) {
+						stage.dependencies.push_back(last_writer[id]);
+					}
+					if (isWrite(argument.access)) {
+						for (uint32_t reader : readers[id]) {
+							if (reader != i) {
+								stage.dependencies.push_back(reader);
+							}
+						}
+					}
+				}
+				for (const PipelineArgument& argument : stage.arguments) {
+					const uint32_t id = argument.buffer.id;
+					if (isWrite(argument.access)) {
+						last_writer[id] = i;
+						readers[id].clear();
+					}
+					else {
+						readers[id].push_back(i);
+					}
+				}
+			}
+		}
+
+		/*
+		Greedy interval allocation: buffers are taken by first use and placed in the smallest free
+		allocation large enough (or the largest free one, which grows). The first stage of the new
+		tenant then depends on every stage of the previous one so they can't run concurrently.
+		*/
+		void assignPhysicalBuffers()
+		{
+			std::vector<uint32_t> order;
+			for (uint32_t i(0); i < m_buffers.size(); ++i) {
+				if (!m_buffers[i].external && m_buffers[i].first_use != Unused) {
+					order.push_back(i);
+				}
+			}
+			std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+				return m_buffers[a].first_use < m_buffers[b].first_use;
+			});
+
+			std::vector<uint32_t> tenant;
+			for (uint32_t id : order) {
+				VirtualBuffer& buffer = m_buffers[id];
+				uint32_t best = Unused;
+				for (uint32_t p(0); p < m_physical_sizes.size(); ++p) {
+					if (m_buffers[tenant[p]].last_use >= buffer.first_use) {
+						continue;
+					}
+					if (best == Unused) {
+						best = p;
+						continue;
+					}
+					const bool fits = m_physical_sizes[p] >= buffer.bytes_size;
+					const bool best_fits = m_physical_sizes[best] >= buffer.bytes_size;
+					if (fits ? !best_fits || m_physical_sizes[p] < m_physical_sizes[best] : !best_fits && m_physical_sizes[p] > m_physical_sizes[best]) {
+						best = p;
+					}
+				}
+
+				if (best == Unused) {
+					m_physical_sizes.push_back(buffer.bytes_size);
+					tenant.push_back(id);
+					buffer.physical = static_cast<uint32_t>(m_physical_sizes.size() - 1u);
+					continue;
+				}
+				const uint32_t previous = tenant[best];
+				for (uint32_t i(m_buffers[previous].first_use); i <= m_buffers[previous].last_use; ++i) {
+					if (usesBuffer(m_stages[i], previous)) {
+						m_stages[buffer.first_use].dependencies.push_back(i);
+					}
+				}
+				m_physical_sizes[best] = std::max(m_physical_sizes[best], buffer.bytes_size);
+				tenant[best] = id;
+				buffer.physical = best;
+			}
+		}
+
+		static bool usesBuffer(const Stage& stage, uint32_t id)
+		{
+			for (const PipelineArgument& argument : stage.arguments) {
+				if (argument.buffer.id == id) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// A kernel continues the lane of its first kernel dependency, siblings start new lanes
+		void assignComputeLanes()
+		{
+			std::vector<bool> continued(m_stages.size(), false);
+			uint32_t next_lane = 0u;
+			for (Stage& stage : m_stages) {
+				if (stage.type != StageType::Kernel) {
+					continue;
+				}
+				bool found = false;
+				for (uint32_t dependency : stage.dependencies) {
+					if (m_stages[dependency].type == StageType::Kernel && !continued[dependency]) {
+						stage.lane = m_stages[dependency].lane;
+						continued[dependency] = true;
+						found = true;
+						break;
+					}
+				}
+				if (!found) {
+					stage.lane = next_lane++;
+				}
+			}
+		}
+
+		MemoryObject& getObject(FrameState& frame, PipelineBuffer buffer)
+		{
+			VirtualBuffer& virtual_buffer = m_buffers[buffer.id];
+			return virtual_buffer.external ? virtual_buffer.object : frame.objects[virtual_buffer.physical];
+		}
+
+		Event enqueue(Stage& stage, FrameState& frame)
+		{
+			std::vector<Event> wait_list;
+			for (uint32_t dependency : stage.dependencies) {
+				wait_list.push_back(frame.events[dependency]);
+			}
+
+			switch (stage.type) {
+			case StageType::Upload: {
+				const PipelineBuffer buffer = stage.arguments[0].buffer;
+				return m_queues[m_upload_queue].writeInMemoryObject(getObject(frame, buffer), stage.source(frame.index), m_buffers[buffer.id].bytes_size, 0u, wait_list);
+			}
+			case StageType::Download: {
+				const PipelineBuffer buffer = stage.arguments[0].buffer;
+				return m_queues[m_download_queue].readMemoryObject(getObject(frame, buffer), stage.destination(frame.index), m_buffers[buffer.id].bytes_size, 0u, wait_list);
+			}
+			case StageType::Kernel: {
+				for (const PipelineArgument& argument : stage.arguments) {
+					stage.kernel.setArgument(argument.arg_num, getObject(frame, argument.buffer));
+				}
+				if (stage.configure) {
+					stage.configure(stage.kernel, frame.index);
+				}
+				// Consecutive frames start on different queues so their kernels overlap
+				CommandQueue& queue = m_queues[m_compute_queues[(stage.lane + frame.index) % m_compute_queues.size()]];
+				return queue.addKernel(stage.kernel, stage.dimension, nullptr, stage.global_size, stage.has_local_size ? stage.local_size : nullptr, wait_list);
+			}
+			default: {
+				HostTask task{ frame.index, static_cast<uint32_t>(&stage - m_stages.data()), Event::createUserEvent(m_wrapper.getContext()), wait_list };
+				m_host_tasks.push_back(task);
+				return task.user_event;
+			}
+			}
+		}
+
+		static bool isReady(const HostTask& task)
+		{
+			for (const Event& event : task.wait_list) {
+				if (!event.isComplete()) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void runHostTask()
+		{
+			HostTask task = m_host_tasks.front();
+			m_host_tasks.pop_front();
+			try {
+				for (const Event& event : task.wait_list) {
+					event.wait();
+				}
+				m_stages[task.stage].callback(task.frame_index);
+			}
+			catch (...) {
+				// Aborts the device stages waiting for this one
+				task.user_event.setComplete(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST);
+				throw;
+			}
+			task.user_event.setComplete();
+		}
+	};
+}
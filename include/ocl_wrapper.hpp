@@ -5,6 +5,17 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <initializer_list>
+#include <limits>
 #include <CL/cl.hpp>
 
 
@@ -109,6 +120,17 @@ namespace oclw
 	};
 
 
+	enum AffinityDomain
+	{
+		NUMA = CL_DEVICE_AFFINITY_DOMAIN_NUMA,
+		L4Cache = CL_DEVICE_AFFINITY_DOMAIN_L4_CACHE,
+		L3Cache = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE,
+		L2Cache = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE,
+		L1Cache = CL_DEVICE_AFFINITY_DOMAIN_L1_CACHE,
+		NextPartitionable = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE
+	};
+
+
 	enum ImageFormat
 	{
 		Red = CL_R,
@@ -131,15 +153,15 @@ namespace oclw
 		Normalized_UINT8 = CL_UNORM_INT8, // Each channel component is a normalized unsigned 8 - bit integer value.
 		Normalized_UINT16 = CL_UNORM_INT16, // Each channel component is a normalized unsigned 16 - bit integer value.
 		NormalizedShort565 = CL_UNORM_SHORT_565, // Represents a normalized 5 - 6 - 5 3 - channel RGB image.The channel order must be CL_RGB.
-		/*CL_UNORM_SHORT_555	Represents a normalized x - 5 - 5 - 5 4 - channel xRGB image.The channel order must be CL_RGB.
-		CL_UNORM_INT_101010	Represents a normalized x - 10 - 10 - 10 4 - channel xRGB image.The channel order must be CL_RGB.
-		CL_SIGNED_INT8	Each channel component is an unnormalized signed 8 - bit integer value.
-		CL_SIGNED_INT16	Each channel component is an unnormalized signed 16 - bit integer value.
-		CL_SIGNED_INT32	Each channel component is an unnormalized signed 32 - bit integer value.*/
+		NormalizedShort555 = CL_UNORM_SHORT_555, // Represents a normalized x - 5 - 5 - 5 4 - channel xRGB image.The channel order must be CL_RGB.
+		NormalizedInt101010 = CL_UNORM_INT_101010, // Represents a normalized x - 10 - 10 - 10 4 - channel xRGB image.The channel order must be CL_RGB.
+		Signed_INT8 = CL_SIGNED_INT8, // Each channel component is an unnormalized signed 8 - bit integer value.
+		Signed_INT16 = CL_SIGNED_INT16, // Each channel component is an unnormalized signed 16 - bit integer value.
+		Signed_INT32 = CL_SIGNED_INT32, // Each channel component is an unnormalized signed 32 - bit integer value.
 		Unsigned_INT8 = CL_UNSIGNED_INT8, // Each channel component is an unnormalized unsigned 8 - bit integer value.
-		/*CL_UNSIGNED_INT16	Each channel component is an unnormalized unsigned 16 - bit integer value.
-		CL_UNSIGNED_INT32	Each channel component is an unnormalized unsigned 32 - bit integer value.
-		CL_HALF_FLOAT	Each channel component is a 16 - bit half - float value.*/
+		Unsigned_INT16 = CL_UNSIGNED_INT16, // Each channel component is an unnormalized unsigned 16 - bit integer value.
+		Unsigned_INT32 = CL_UNSIGNED_INT32, // Each channel component is an unnormalized unsigned 32 - bit integer value.
+		HalfFloat = CL_HALF_FLOAT, // Each channel component is a 16 - bit half - float value.
 		Float = CL_FLOAT
 	};
 
@@ -195,6 +217,14 @@ namespace oclw
 			}
 		}
 
+		template<typename T>
+		static T getDeviceInfo(cl_device_id device, cl_device_info param)
+		{
+			T value;
+			checkError(clGetDeviceInfo(device, param, sizeof(T), &value, NULL), "Cannot get device info");
+			return value;
+		}
+
 		static cl_image_desc getDefaultImageDesc()
 		{
 			cl_image_desc image_desc;
@@ -212,6 +242,250 @@ namespace oclw
 	};
 
 
+	enum class CaptureOperation : uint8_t
+	{
+		BuildProgram = 1,
+		CreateKernel,
+		CreateBuffer,
+		CreateImage,
+		WriteBuffer,
+		ReadBuffer,
+		ReadImage,
+		SetArgumentObject,
+		SetArgumentValue,
+		RunKernel,
+		Finish
+	};
+
+
+	/*
+	Records every call made through the wrapper in a compact binary file so it can be replayed offline.
+	OpenCL handles are stored as ids, buffer contents are only stored when data capture is enabled.
+	Only one capture can be active at a time.
+	*/
+	class Capture
+	{
+	public:
+		static const uint32_t Magic = 0x574C434Fu; // "OCLW"
+		static const uint32_t Version = 1u;
+
+		Capture(const std::string& filename, bool with_data)
+			: m_file(filename, std::ios::out | std::ios::binary)
+			, m_with_data(with_data)
+		{
+			if (!m_file.is_open()) {
+				throw Exception(-1, "Cannot open capture file '" + filename + "'");
+			}
+			write(Magic);
+			write(Version);
+		}
+
+		// The returned reference keeps the capture alive while recording, even if it is stopped meanwhile
+		static std::shared_ptr<Capture> getActive()
+		{
+			// Fast path for the common case of no capture running
+			if (!activeFlag().load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+			std::lock_guard<std::mutex> lock(activeMutex());
+			return activeInstance();
+		}
+
+		static void setActive(const std::shared_ptr<Capture>& capture)
+		{
+			std::lock_guard<std::mutex> lock(activeMutex());
+			activeInstance() = capture;
+			activeFlag().store(capture != nullptr, std::memory_order_release);
+		}
+
+		// Deactivates the capture only if it is still the active one
+		static void clearActive(const Capture* capture)
+		{
+			std::lock_guard<std::mutex> lock(activeMutex());
+			if (activeInstance().get() == capture) {
+				activeInstance().reset();
+				activeFlag().store(false, std::memory_order_release);
+			}
+		}
+
+		void recordBuildProgram(cl_program program, const std::string& source, const std::string& options)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::BuildProgram);
+			writeHandle(program);
+			writeString(source);
+			writeString(options);
+		}
+
+		void recordCreateKernel(cl_kernel kernel, cl_program program, const std::string& name)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::CreateKernel);
+			writeHandle(kernel);
+			writeHandle(program);
+			writeString(name);
+		}
+
+		void recordCreateBuffer(cl_mem buffer, uint64_t flags, uint64_t bytes_size, const void* data)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::CreateBuffer);
+			writeHandle(buffer);
+			write(flags);
+			write(bytes_size);
+			writeData(data, bytes_size);
+		}
+
+		void recordCreateImage(cl_mem image, uint64_t flags, cl_mem_object_type type, const cl_image_format& format, uint64_t width, uint64_t height, uint64_t depth)
+		{
+			// Image contents are never captured since their host layout depends on the format
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::CreateImage);
+			writeHandle(image);
+			write(flags);
+			write(static_cast<uint32_t>(type));
+			write(static_cast<uint32_t>(format.image_channel_order));
+			write(static_cast<uint32_t>(format.image_channel_data_type));
+			write(width);
+			write(height);
+			write(depth);
+		}
+
+		void recordWriteBuffer(cl_mem buffer, uint64_t offset, uint64_t bytes_size, const void* data)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::WriteBuffer);
+			writeHandle(buffer);
+			write(offset);
+			write(bytes_size);
+			writeData(data, bytes_size);
+		}
+
+		void recordReadBuffer(cl_mem buffer, uint64_t offset, uint64_t bytes_size)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::ReadBuffer);
+			writeHandle(buffer);
+			write(offset);
+			write(bytes_size);
+		}
+
+		void recordReadImage(cl_mem image, uint64_t width, uint64_t height)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::ReadImage);
+			writeHandle(image);
+			write(width);
+			write(height);
+		}
+
+		void recordSetArgumentObject(cl_kernel kernel, uint32_t arg_num, cl_mem object)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::SetArgumentObject);
+			writeHandle(kernel);
+			write(arg_num);
+			writeHandle(object);
+		}
+
+		void recordSetArgumentValue(cl_kernel kernel, uint32_t arg_num, uint64_t arg_size, const void* arg_value)
+		{
+			// Values are always stored, they are needed to replay the launch
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::SetArgumentValue);
+			writeHandle(kernel);
+			write(arg_num);
+			write(arg_size);
+			write(static_cast<uint8_t>(arg_value != nullptr));
+			if (arg_value) {
+				m_file.write(static_cast<const char*>(arg_value), arg_size);
+			}
+		}
+
+		void recordRunKernel(cl_kernel kernel, uint32_t work_dimension, const std::size_t* global_work_offset, const std::size_t* global_work_size, const std::size_t* local_work_size)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::RunKernel);
+			writeHandle(kernel);
+			write(work_dimension);
+			writeSizes(global_work_offset, work_dimension);
+			writeSizes(global_work_size, work_dimension);
+			writeSizes(local_work_size, work_dimension);
+		}
+
+		void recordFinish()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			beginRecord(CaptureOperation::Finish);
+		}
+
+	private:
+		std::ofstream m_file;
+		const bool m_with_data;
+		std::mutex m_mutex;
+
+		static std::shared_ptr<Capture>& activeInstance()
+		{
+			static std::shared_ptr<Capture> instance;
+			return instance;
+		}
+
+		static std::atomic<bool>& activeFlag()
+		{
+			static std::atomic<bool> active(false);
+			return active;
+		}
+
+		static std::mutex& activeMutex()
+		{
+			static std::mutex mutex;
+			return mutex;
+		}
+
+		template<typename T>
+		void write(const T& value)
+		{
+			m_file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		void beginRecord(CaptureOperation operation)
+		{
+			write(static_cast<uint8_t>(operation));
+		}
+
+		template<typename T>
+		void writeHandle(T handle)
+		{
+			write(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(handle)));
+		}
+
+		void writeString(const std::string& str)
+		{
+			write(static_cast<uint32_t>(str.size()));
+			m_file.write(str.data(), str.size());
+		}
+
+		void writeData(const void* data, uint64_t bytes_size)
+		{
+			const bool store_data = m_with_data && data;
+			write(static_cast<uint8_t>(store_data));
+			if (store_data) {
+				m_file.write(static_cast<const char*>(data), bytes_size);
+			}
+		}
+
+		void writeSizes(const std::size_t* sizes, uint32_t dimension)
+		{
+			write(static_cast<uint8_t>(sizes != nullptr));
+			if (sizes) {
+				for (uint32_t i(0); i < dimension; ++i) {
+					write(static_cast<uint64_t>(sizes[i]));
+				}
+			}
+		}
+	};
+
+
 	class CommandQueue;
 
 
@@ -242,8 +516,25 @@ namespace oclw
 			initialize(context, mode, m_total_size, NULL);
 		}
 
+		MemoryObject(const MemoryObject& other)
+			: m_memory_object(other.m_memory_object)
+			, m_element_count(other.m_element_count)
+			, m_total_size(other.m_total_size)
+		{
+			if (m_memory_object) {
+				cl_int err_num = clRetainMemObject(m_memory_object);
+				Utils::checkError(err_num, "Cannot retain memory object");
+			}
+		}
+
 		MemoryObject& operator=(const MemoryObject& other)
 		{
+			if (this == &other) {
+				return *this;
+			}
+			if (m_memory_object) {
+				clReleaseMemObject(m_memory_object);
+			}
 			m_memory_object = other.m_memory_object;
 			m_element_count = other.m_element_count;
 			m_total_size = other.m_total_size;
@@ -291,6 +582,9 @@ namespace oclw
 			cl_int err_num;
 			m_memory_object = clCreateBuffer(context, mode, m_total_size, data, &err_num);
 			Utils::checkError(err_num, "Cannot create memory object");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordCreateBuffer(m_memory_object, mode, m_total_size, (mode & CL_MEM_COPY_HOST_PTR) ? data : nullptr);
+			}
 		}
 	};
 
@@ -331,6 +625,268 @@ namespace oclw
 	};
 
 
+	// Declares a __local kernel argument, only its size is given to the kernel
+	struct LocalMemory
+	{
+		LocalMemory(std::size_t bytes_size_)
+			: bytes_size(bytes_size_)
+		{}
+
+		template<typename T>
+		static LocalMemory of(std::size_t element_count)
+		{
+			return LocalMemory(sizeof(T) * element_count);
+		}
+
+		const std::size_t bytes_size;
+	};
+
+
+	struct KernelResources
+	{
+		std::size_t work_group_size;
+		std::size_t compile_work_group_size[3];
+		std::size_t preferred_work_group_size_multiple;
+		uint64_t local_mem_size;
+		uint64_t private_mem_size;
+	};
+
+
+	struct OccupancyReport
+	{
+		KernelResources resources;
+		uint32_t compute_units;
+		uint64_t device_local_mem_size;
+		std::size_t local_size;
+		std::size_t work_groups_count;
+		// Estimated number of work-groups that can be resident on one compute unit at the same time
+		std::size_t work_groups_per_compute_unit;
+		// Fraction of the device's resident work-group slots the launch fills, in [0, 1]
+		double occupancy;
+		std::vector<std::string> warnings;
+
+		void print(std::ostream& stream = std::cout) const
+		{
+			stream << "Work-group size " << local_size << " (max " << resources.work_group_size << ", preferred multiple " << resources.preferred_work_group_size_multiple << ")" << std::endl;
+			stream << "Local memory " << resources.local_mem_size << " / " << device_local_mem_size << " bytes, private memory " << resources.private_mem_size << " bytes" << std::endl;
+			stream << work_groups_count << " work-groups on " << compute_units << " compute units, " << work_groups_per_compute_unit << " resident per compute unit, occupancy " << occupancy * 100.0 << "%" << std::endl;
+			for (const std::string& warning : warnings) {
+				stream << "Warning: " << warning << std::endl;
+			}
+		}
+	};
+
+
+	// OpenCL C name of a host type, empty for types without an equivalent (structs)
+	template<typename T>
+	struct TypeName
+	{
+		static const bool known = false;
+		static const char* get() { return ""; }
+	};
+
+#define OCLW_TYPE_NAME(type, name)                                   \
+	template<> struct TypeName<type>                                 \
+	{                                                                \
+		static const bool known = true;                              \
+		static const char* get() { return name; }                    \
+	};
+
+	OCLW_TYPE_NAME(char, "char")
+	OCLW_TYPE_NAME(int8_t, "char")
+	OCLW_TYPE_NAME(uint8_t, "uchar")
+	OCLW_TYPE_NAME(int16_t, "short")
+	OCLW_TYPE_NAME(uint16_t, "ushort")
+	OCLW_TYPE_NAME(int32_t, "int")
+	OCLW_TYPE_NAME(uint32_t, "uint")
+	OCLW_TYPE_NAME(int64_t, "long")
+	OCLW_TYPE_NAME(uint64_t, "ulong")
+	OCLW_TYPE_NAME(float, "float")
+	OCLW_TYPE_NAME(double, "double")
+
+	// cl_<type>3 is a typedef of cl_<type>4 on the host
+#define OCLW_VECTOR_TYPE_NAMES(type, name)                           \
+	OCLW_TYPE_NAME(type##2, name "2")                                \
+	OCLW_TYPE_NAME(type##4, name "4")                                \
+	OCLW_TYPE_NAME(type##8, name "8")                                \
+	OCLW_TYPE_NAME(type##16, name "16")
+
+	OCLW_VECTOR_TYPE_NAMES(cl_char, "char")
+	OCLW_VECTOR_TYPE_NAMES(cl_uchar, "uchar")
+	OCLW_VECTOR_TYPE_NAMES(cl_short, "short")
+	OCLW_VECTOR_TYPE_NAMES(cl_ushort, "ushort")
+	OCLW_VECTOR_TYPE_NAMES(cl_int, "int")
+	OCLW_VECTOR_TYPE_NAMES(cl_uint, "uint")
+	OCLW_VECTOR_TYPE_NAMES(cl_long, "long")
+	OCLW_VECTOR_TYPE_NAMES(cl_ulong, "ulong")
+	OCLW_VECTOR_TYPE_NAMES(cl_float, "float")
+	OCLW_VECTOR_TYPE_NAMES(cl_double, "double")
+
+#undef OCLW_VECTOR_TYPE_NAMES
+#undef OCLW_TYPE_NAME
+
+
+	enum class KernelArgumentKind
+	{
+		Memory,
+		Local,
+		Value
+	};
+
+
+	struct KernelArgument
+	{
+		std::string name;
+		std::string type_name;
+		KernelArgumentKind kind;
+		// Size of by-value arguments, 0 when it can't be deduced from the type name (structs)
+		std::size_t size;
+
+		std::string getDescription() const
+		{
+			return std::string(getKindName(kind)) + " " + type_name;
+		}
+
+		// Values are matched by OpenCL type name when both types are known, by size otherwise (structs)
+		bool accepts(KernelArgumentKind value_kind, std::size_t value_size, const char* value_type_name) const
+		{
+			if (kind != value_kind) {
+				return false;
+			}
+			if (kind != KernelArgumentKind::Value || !size || !value_size) {
+				return true;
+			}
+			if (*value_type_name) {
+				return isSameType(type_name, value_type_name);
+			}
+			return size == value_size;
+		}
+
+		static bool isSameType(const std::string& parameter_type_name, const std::string& value_type_name)
+		{
+			if (parameter_type_name == value_type_name) {
+				return true;
+			}
+			// cl_half is a cl_ushort on the host
+			if (parameter_type_name == "half" && value_type_name == "ushort") {
+				return true;
+			}
+			// 3 components vectors are bound with 4 components ones
+			const std::size_t length = parameter_type_name.size();
+			return length > 1u && parameter_type_name[length - 1u] == '3' && value_type_name == parameter_type_name.substr(0, length - 1u) + "4";
+		}
+
+		// Some implementations spell unsigned types out ("unsigned int" for "uint")
+		static std::string normalizeTypeName(const std::string& type_name)
+		{
+			const std::string prefix = "unsigned ";
+			if (type_name.compare(0, prefix.size(), prefix) == 0) {
+				return "u" + type_name.substr(prefix.size());
+			}
+			return type_name;
+		}
+
+		static const char* getKindName(KernelArgumentKind kind)
+		{
+			switch (kind) {
+			case KernelArgumentKind::Memory:
+				return "memory object";
+			case KernelArgumentKind::Local:
+				return "local buffer";
+			default:
+				return "value";
+			}
+		}
+
+		// Size of OpenCL C scalar and vector types, 3 components vectors have the size of 4 components ones
+		static std::size_t getTypeSize(const std::string& type_name)
+		{
+			const std::vector<std::pair<std::string, std::size_t>> scalars = {
+				{ "char", 1u }, { "uchar", 1u }, { "short", 2u }, { "ushort", 2u }, { "half", 2u },
+				{ "int", 4u }, { "uint", 4u }, { "float", 4u }, { "long", 8u }, { "ulong", 8u }, { "double", 8u }
+			};
+			const std::size_t digits = type_name.find_first_of("0123456789");
+			const std::string base = type_name.substr(0, digits);
+			const std::size_t components = digits == std::string::npos ? 1u : std::stoul(type_name.substr(digits));
+			for (const auto& scalar : scalars) {
+				if (scalar.first == base) {
+					return scalar.second * (components == 3u ? 4u : components);
+				}
+			}
+			return 0u;
+		}
+	};
+
+
+	struct KernelSignature
+	{
+		std::vector<KernelArgument> arguments;
+
+		int32_t getIndex(const std::string& arg_name) const
+		{
+			for (std::size_t i(0); i < arguments.size(); ++i) {
+				if (arguments[i].name == arg_name) {
+					return static_cast<int32_t>(i);
+				}
+			}
+			return -1;
+		}
+
+		static KernelSignature reflect(cl_kernel kernel, const std::string& kernel_name)
+		{
+			cl_uint arguments_count = 0;
+			Utils::checkError(clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &arguments_count, NULL), "Cannot get arguments of kernel '" + kernel_name + "'");
+
+			KernelSignature signature;
+			for (cl_uint i(0); i < arguments_count; ++i) {
+				KernelArgument argument;
+				argument.name = getArgumentInfo(kernel, kernel_name, i, CL_KERNEL_ARG_NAME);
+				argument.type_name = KernelArgument::normalizeTypeName(getArgumentInfo(kernel, kernel_name, i, CL_KERNEL_ARG_TYPE_NAME));
+
+				cl_kernel_arg_address_qualifier address_qualifier;
+				const cl_int err_num = clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(address_qualifier), &address_qualifier, NULL);
+				checkArgumentInfoError(err_num, kernel_name);
+
+				// Images and samplers are reported as private but are bound like memory objects
+				const bool is_pointer = argument.type_name.find('*') != std::string::npos;
+				const bool is_object = argument.type_name.compare(0, 5, "image") == 0 || argument.type_name == "sampler_t";
+				if (address_qualifier == CL_KERNEL_ARG_ADDRESS_LOCAL) {
+					argument.kind = KernelArgumentKind::Local;
+				}
+				else if (is_pointer || is_object) {
+					argument.kind = KernelArgumentKind::Memory;
+				}
+				else {
+					argument.kind = KernelArgumentKind::Value;
+				}
+				argument.size = argument.kind == KernelArgumentKind::Value ? KernelArgument::getTypeSize(argument.type_name) : 0u;
+				signature.arguments.push_back(argument);
+			}
+			return signature;
+		}
+
+	private:
+		static std::string getArgumentInfo(cl_kernel kernel, const std::string& kernel_name, cl_uint arg_num, cl_kernel_arg_info param)
+		{
+			std::size_t size = 0;
+			checkArgumentInfoError(clGetKernelArgInfo(kernel, arg_num, param, 0, NULL, &size), kernel_name);
+			std::string value(size, '\0');
+			checkArgumentInfoError(clGetKernelArgInfo(kernel, arg_num, param, size, &value[0], NULL), kernel_name);
+			// Drop the null terminator
+			value.resize(size ? size - 1 : 0);
+			return value;
+		}
+
+		static void checkArgumentInfoError(cl_int err_num, const std::string& kernel_name)
+		{
+			if (err_num == CL_KERNEL_ARG_INFO_NOT_AVAILABLE) {
+				Utils::checkError(err_num, "Cannot reflect kernel '" + kernel_name + "', its program must be built with -cl-kernel-arg-info");
+			}
+			Utils::checkError(err_num, "Cannot reflect kernel '" + kernel_name + "'");
+		}
+	};
+
+
 	class Kernel
 	{
 	public:
@@ -343,115 +899,735 @@ namespace oclw
 			: m_kernel(nullptr)
 			, m_name(name)
 		{
-			cl_int err_num;
-			m_kernel = clCreateKernel(program, name.c_str(), &err_num);
-			Utils::checkError(err_num, "Cannot create kernel '" + name + "'");
+			cl_int err_num;
+			m_kernel = clCreateKernel(program, name.c_str(), &err_num);
+			Utils::checkError(err_num, "Cannot create kernel '" + name + "'");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordCreateKernel(m_kernel, program, name);
+			}
+		}
+
+		void setArgument(uint32_t arg_num, MemoryObject& object)
+		{
+			checkArgumentError(clSetKernelArg(m_kernel, arg_num, sizeof(cl_mem), &(object.getRaw())), arg_num);
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordSetArgumentObject(m_kernel, arg_num, object.getRaw());
+			}
+		}
+
+		void setArgument(uint32_t arg_num, Image& object)
+		{
+			checkArgumentError(clSetKernelArg(m_kernel, arg_num, sizeof(cl_mem), &(object.getRaw())), arg_num);
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordSetArgumentObject(m_kernel, arg_num, object.getRaw());
+			}
+		}
+
+		template<typename T>
+		void setArgument(uint32_t arg_num, const T& arg_value)
+		{
+			checkArgumentError(clSetKernelArg(m_kernel, arg_num, sizeof(T), &arg_value), arg_num);
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordSetArgumentValue(m_kernel, arg_num, sizeof(T), &arg_value);
+			}
+		}
+
+		void setArgument(uint32_t arg_num, const LocalMemory& local_memory)
+		{
+			setArgument(arg_num, local_memory.bytes_size, nullptr);
+		}
+
+		void setArgument(uint32_t arg_num, std::size_t arg_size, const void* arg_value)
+		{
+			checkArgumentError(clSetKernelArg(m_kernel, arg_num, arg_size, arg_value), arg_num);
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordSetArgumentValue(m_kernel, arg_num, arg_size, arg_value);
+			}
+		}
+
+		// Name based binding, the program must be built with -cl-kernel-arg-info
+		void setArgument(const std::string& arg_name, MemoryObject& object)
+		{
+			const uint32_t arg_num = getArgumentIndex(arg_name);
+			checkArgumentKind(arg_num, KernelArgumentKind::Memory, sizeof(cl_mem));
+			setArgument(arg_num, object);
+		}
+
+		void setArgument(const std::string& arg_name, Image& object)
+		{
+			const uint32_t arg_num = getArgumentIndex(arg_name);
+			checkArgumentKind(arg_num, KernelArgumentKind::Memory, sizeof(cl_mem));
+			setArgument(arg_num, object);
+		}
+
+		void setArgument(const std::string& arg_name, const LocalMemory& local_memory)
+		{
+			const uint32_t arg_num = getArgumentIndex(arg_name);
+			checkArgumentKind(arg_num, KernelArgumentKind::Local, 0u);
+			setArgument(arg_num, local_memory);
+		}
+
+		template<typename T>
+		void setArgument(const std::string& arg_name, const T& arg_value)
+		{
+			const uint32_t arg_num = getArgumentIndex(arg_name);
+			checkArgumentKind(arg_num, KernelArgumentKind::Value, sizeof(T), TypeName<T>::get());
+			setArgument(arg_num, arg_value);
+		}
+
+		// Reflected once and shared between copies of this kernel
+		const KernelSignature& getSignature()
+		{
+			if (!m_signature) {
+				m_signature = std::make_shared<const KernelSignature>(KernelSignature::reflect(m_kernel, m_name));
+			}
+			return *m_signature;
+		}
+
+		uint32_t getArgumentIndex(const std::string& arg_name)
+		{
+			const int32_t index = getSignature().getIndex(arg_name);
+			if (index < 0) {
+				throw Exception(CL_INVALID_ARG_INDEX, "Kernel '" + m_name + "' has no argument '" + arg_name + "'");
+			}
+			return static_cast<uint32_t>(index);
+		}
+
+		// Checks an argument accepts a value of this kind, type (if known) and size (0 skips the size check)
+		void checkArgumentKind(uint32_t arg_num, KernelArgumentKind kind, std::size_t size, const char* type_name = "")
+		{
+			const KernelArgument& argument = getSignature().arguments[arg_num];
+			if (argument.accepts(kind, size, type_name)) {
+				return;
+			}
+			if (argument.kind != kind) {
+				throw Exception(CL_INVALID_ARG_VALUE, "Argument '" + argument.name + "' of kernel '" + m_name + "' is a " + argument.getDescription() + ", it cannot be bound to a " + KernelArgument::getKindName(kind));
+			}
+			if (*type_name) {
+				throw Exception(CL_INVALID_ARG_VALUE, "Argument '" + argument.name + "' of kernel '" + m_name + "' is a " + argument.getDescription() + ", it cannot be bound to a " + type_name + " value");
+			}
+			std::stringstream ssx;
+			ssx << "Argument '" << argument.name << "' of kernel '" << m_name << "' is a " << argument.getDescription() << " (" << argument.size << " bytes), it cannot be bound to a " << size << " bytes value";
+			throw Exception(CL_INVALID_ARG_SIZE, ssx.str());
+		}
+
+		Kernel(const Kernel& other)
+			: m_kernel(other.m_kernel)
+			, m_name(other.m_name)
+			, m_signature(other.m_signature)
+		{
+			if (m_kernel) {
+				Utils::checkError(clRetainKernel(m_kernel), "Cannot retain kernel");
+			}
+		}
+
+		Kernel& operator=(const Kernel& other)
+		{
+			if (this == &other) {
+				return *this;
+			}
+			if (m_kernel) {
+				clReleaseKernel(m_kernel);
+			}
+			m_name = other.m_name;
+			m_kernel = other.m_kernel;
+			m_signature = other.m_signature;
+			if (m_kernel) {
+				Utils::checkError(clRetainKernel(m_kernel), "Cannot retain kernel");
+			}
+			return *this;
+		}
+
+		~Kernel()
+		{
+			if (m_kernel) {
+				clReleaseKernel(m_kernel);
+			}
+		}
+
+		cl_kernel& getRaw()
+		{
+			return m_kernel;
+		}
+
+		const std::string& getName() const
+		{
+			return m_name;
+		}
+
+		KernelResources getResources(cl_device_id device) const
+		{
+			KernelResources resources;
+			getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(std::size_t), &resources.work_group_size);
+			getWorkGroupInfo(device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(resources.compile_work_group_size), resources.compile_work_group_size);
+			getWorkGroupInfo(device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(std::size_t), &resources.preferred_work_group_size_multiple);
+			cl_ulong value;
+			getWorkGroupInfo(device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &value);
+			resources.local_mem_size = value;
+			getWorkGroupInfo(device, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong), &value);
+			resources.private_mem_size = value;
+			return resources;
+		}
+
+		/*
+		OpenCL doesn't expose how many work-items a compute unit can keep resident, the kernel's
+		maximum work-group size is used as an estimate, bounded by the local memory the kernel needs
+		(including __local arguments already set).
+		*/
+		OccupancyReport getOccupancyReport(cl_device_id device, const Size& global_size, const Size& local_size) const
+		{
+			OccupancyReport report;
+			report.resources = getResources(device);
+			report.compute_units = Utils::getDeviceInfo<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS);
+			report.device_local_mem_size = Utils::getDeviceInfo<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE);
+
+			report.local_size = 1u;
+			report.work_groups_count = 1u;
+			for (uint32_t i(0); i < global_size.dimension; ++i) {
+				const std::size_t local = i < local_size.dimension ? std::max<std::size_t>(local_size.sizes[i], 1u) : 1u;
+				report.local_size *= local;
+				report.work_groups_count *= (global_size.sizes[i] + local - 1u) / local;
+			}
+
+			const KernelResources& resources = report.resources;
+			const std::size_t by_work_items = std::max<std::size_t>(resources.work_group_size / report.local_size, 1u);
+			// Kernels without local memory aren't limited by it
+			const std::size_t by_local_mem = resources.local_mem_size ? static_cast<std::size_t>(report.device_local_mem_size / resources.local_mem_size) : std::numeric_limits<std::size_t>::max();
+			report.work_groups_per_compute_unit = std::max<std::size_t>(std::min(by_work_items, by_local_mem), 1u);
+
+			const std::size_t slots = report.work_groups_per_compute_unit * report.compute_units;
+			report.occupancy = std::min(1.0, static_cast<double>(report.work_groups_count) / static_cast<double>(slots));
+
+			std::stringstream ssx;
+			if (report.local_size > resources.work_group_size) {
+				ssx << "local size " << report.local_size << " exceeds the kernel's maximum work-group size " << resources.work_group_size;
+				report.warnings.push_back(ssx.str());
+			}
+			const std::size_t* compile_size = resources.compile_work_group_size;
+			if (compile_size[0] && compile_size[0] * std::max<std::size_t>(compile_size[1], 1u) * std::max<std::size_t>(compile_size[2], 1u) != report.local_size) {
+				report.warnings.push_back("local size doesn't match the kernel's reqd_work_group_size attribute");
+			}
+			if (resources.preferred_work_group_size_multiple && report.local_size % resources.preferred_work_group_size_multiple) {
+				ssx.str("");
+				ssx << "local size " << report.local_size << " is not a multiple of " << resources.preferred_work_group_size_multiple << ", some lanes will stay idle";
+				report.warnings.push_back(ssx.str());
+			}
+			if (resources.local_mem_size && by_local_mem < 2u) {
+				ssx.str("");
+				ssx << "local memory usage (" << resources.local_mem_size << " bytes) allows a single resident work-group per compute unit";
+				report.warnings.push_back(ssx.str());
+			}
+			if (report.work_groups_count < report.compute_units) {
+				ssx.str("");
+				ssx << "only " << report.work_groups_count << " work-groups for " << report.compute_units << " compute units, the device is under-occupied";
+				report.warnings.push_back(ssx.str());
+			}
+			else if (report.work_groups_count < slots) {
+				ssx.str("");
+				ssx << report.work_groups_count << " work-groups fill " << static_cast<uint32_t>(report.occupancy * 100.0) << "% of the " << slots << " resident slots, the device is under-occupied";
+				report.warnings.push_back(ssx.str());
+			}
+
+			return report;
+		}
+
+	private:
+		cl_kernel m_kernel;
+		std::string m_name;
+		std::shared_ptr<const KernelSignature> m_signature;
+
+		void checkArgumentError(cl_int err_num, uint32_t arg_num) const
+		{
+			// The message is only formatted on failure, setting arguments is on the launch path
+			if (err_num != CL_SUCCESS) {
+				std::stringstream ssx;
+				ssx << "Cannot set argument [" << arg_num << "] of kernel '" << m_name << "'";
+				Utils::checkError(err_num, ssx.str());
+			}
+		}
+
+		void getWorkGroupInfo(cl_device_id device, cl_kernel_work_group_info param, std::size_t size, void* value) const
+		{
+			Utils::checkError(clGetKernelWorkGroupInfo(m_kernel, device, param, size, value, NULL), "Cannot get work-group info of kernel '" + m_name + "'");
+		}
+	};
+
+
+	/*
+	Resolves argument names to indices once, then binds by slot (position in the names list)
+	with integer checks only, value types are compared by name the first time they are bound. Meant for kernels relaunched in a loop where name lookups and
+	string handling would show up in the launch overhead.
+	*/
+	class BindPlan
+	{
+	public:
+		BindPlan(Kernel& kernel, std::initializer_list<std::string> arg_names)
+			: m_kernel(reflect(kernel))
+		{
+			for (const std::string& arg_name : arg_names) {
+				const uint32_t arg_num = m_kernel.getArgumentIndex(arg_name);
+				m_slots.push_back({ arg_num, m_kernel.getSignature().arguments[arg_num], nullptr });
+			}
+		}
+
+		void set(uint32_t slot, MemoryObject& object)
+		{
+			const Slot& checked_slot = checkSlot(slot, KernelArgumentKind::Memory, sizeof(cl_mem));
+			m_kernel.setArgument(checked_slot.arg_num, object);
+		}
+
+		void set(uint32_t slot, Image& object)
+		{
+			const Slot& checked_slot = checkSlot(slot, KernelArgumentKind::Memory, sizeof(cl_mem));
+			m_kernel.setArgument(checked_slot.arg_num, object);
+		}
+
+		void set(uint32_t slot, const LocalMemory& local_memory)
+		{
+			const Slot& checked_slot = checkSlot(slot, KernelArgumentKind::Local, 0u);
+			m_kernel.setArgument(checked_slot.arg_num, local_memory);
+		}
+
+		template<typename T>
+		void set(uint32_t slot, const T& arg_value)
+		{
+			const Slot& checked_slot = checkSlot(slot, KernelArgumentKind::Value, sizeof(T), TypeName<T>::get());
+			m_kernel.setArgument(checked_slot.arg_num, arg_value);
+		}
+
+		Kernel& getKernel()
+		{
+			return m_kernel;
+		}
+
+		std::size_t getSlotsCount() const
+		{
+			return m_slots.size();
+		}
+
+	private:
+		struct Slot
+		{
+			uint32_t arg_num;
+			KernelArgument argument;
+			// Type names are static strings, a type accepted once is then recognized by address
+			const char* accepted_type_name;
+		};
+
+		Kernel m_kernel;
+		std::vector<Slot> m_slots;
+
+		// Reflects before copying so the caller's kernel and the plan share the signature
+		static Kernel& reflect(Kernel& kernel)
+		{
+			kernel.getSignature();
+			return kernel;
+		}
+
+		const Slot& checkSlot(uint32_t slot, KernelArgumentKind kind, std::size_t size, const char* type_name = "")
+		{
+			if (slot >= m_slots.size()) {
+				throw Exception(CL_INVALID_ARG_INDEX, "Bind plan of kernel '" + m_kernel.getName() + "' has no slot " + std::to_string(slot));
+			}
+			Slot& checked_slot = m_slots[slot];
+			if (kind == KernelArgumentKind::Value && *type_name) {
+				if (type_name != checked_slot.accepted_type_name) {
+					// Slow path, reports the mismatch with the same message as name based binding
+					m_kernel.checkArgumentKind(checked_slot.arg_num, kind, size, type_name);
+					checked_slot.accepted_type_name = type_name;
+				}
+				return checked_slot;
+			}
+			if (!checked_slot.argument.accepts(kind, size, type_name)) {
+				m_kernel.checkArgumentKind(checked_slot.arg_num, kind, size, type_name);
+			}
+			return checked_slot;
+		}
+	};
+
+
+	struct BuildLog
+	{
+		cl_device_id device;
+		cl_build_status status;
+		std::string log;
+	};
+
+
+	class Program
+	{
+	public:
+		Program(cl_program program = nullptr)
+			: m_program(program)
+		{}
+
+		// Builds for all the context's devices, device is used to fetch the build log
+		Program(cl_context context, const std::string& source, cl_device_id device, const std::string& options = "")
+			: m_program(nullptr)
+		{
+			build(context, source, 0, NULL, device, options);
+		}
+
+		// Builds only for the given devices (or sub-devices)
+		Program(cl_context context, const std::string& source, const std::vector<cl_device_id>& devices, const std::string& options = "")
+			: m_program(nullptr)
+		{
+			if (devices.empty()) {
+				throw Exception(CL_INVALID_VALUE, "Cannot build program without device");
+			}
+			build(context, source, static_cast<cl_uint>(devices.size()), devices.data(), devices.front(), options);
+		}
+
+		Program(const Program& other)
+			: m_program(other.m_program)
+		{
+			if (m_program) {
+				Utils::checkError(clRetainProgram(m_program), "Cannot retain program");
+			}
+		}
+
+		Program& operator=(const Program& other)
+		{
+			if (this == &other) {
+				return *this;
+			}
+			if (m_program) {
+				clReleaseProgram(m_program);
+			}
+			m_program = other.m_program;
+			if (m_program) {
+				Utils::checkError(clRetainProgram(m_program), "Cannot retain program");
+			}
+			return *this;
+		}
+
+		~Program()
+		{
+			if (m_program) {
+				clReleaseProgram(m_program);
+			}
+		}
+
+		operator bool() const
+		{
+			return m_program;
+		}
+
+		Kernel createKernel(const std::string& kernel_name)
+		{
+			return Kernel(m_program, kernel_name);
+		}
+
+		cl_program getRaw() const
+		{
+			return m_program;
+		}
+
+		static std::string getBuildLog(cl_program program, cl_device_id device)
+		{
+			std::size_t log_size = 0;
+			clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+			std::string build_log(log_size, '\0');
+			if (log_size) {
+				clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, &build_log[0], NULL);
+				// Drop the null terminator
+				build_log.resize(log_size - 1);
+			}
+			return build_log;
+		}
+
+		// Status and full log of every device the program is associated with
+		static std::vector<BuildLog> getBuildLogs(cl_program program)
+		{
+			std::size_t devices_size = 0;
+			Utils::checkError(clGetProgramInfo(program, CL_PROGRAM_DEVICES, 0, NULL, &devices_size), "Cannot get program devices");
+			std::vector<cl_device_id> devices(devices_size / sizeof(cl_device_id));
+			Utils::checkError(clGetProgramInfo(program, CL_PROGRAM_DEVICES, devices_size, devices.data(), NULL), "Cannot get program devices");
+
+			std::vector<BuildLog> logs;
+			for (cl_device_id device : devices) {
+				BuildLog log;
+				log.device = device;
+				clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &log.status, NULL);
+				log.log = getBuildLog(program, device);
+				logs.push_back(log);
+			}
+			return logs;
+		}
+
+	private:
+		cl_program m_program;
+
+		void build(cl_context context, const std::string& source, cl_uint devices_count, const cl_device_id* devices, cl_device_id log_device, const std::string& options)
+		{
+			int32_t err_num;
+			const char *src_str = source.c_str();
+			m_program = clCreateProgramWithSource(context, 1, (const char**)&src_str, NULL, &err_num);
+			Utils::checkError(err_num, "Cannot create program");
+
+			err_num = clBuildProgram(m_program, devices_count, devices, options.c_str(), NULL, NULL);
+			if (err_num != CL_SUCCESS) {
+				// Determine the reason for the error
+				const std::string build_log = getBuildLog(m_program, log_device);
+				clReleaseProgram(m_program);
+				m_program = nullptr;
+				Utils::checkError(err_num, "Cannot build program: '" + build_log + "'");
+			}
+
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordBuildProgram(m_program, source, options);
+			}
+		}
+	};
+
+
+	/*
+	Handle on a program being built on a worker thread. Builds started together run in parallel,
+	the handle can be polled or waited for and keeps the full build log of every device.
+	*/
+	class ProgramBuild
+	{
+	public:
+		ProgramBuild() = default;
+
+		// An empty devices list builds for all the context's devices, on_completion is called from the worker thread
+		ProgramBuild(cl_context context, const std::string& source, const std::vector<cl_device_id>& devices, const std::string& options, std::function<void()> on_completion = nullptr)
+		{
+			m_result = std::async(std::launch::async, [context, source, devices, options, on_completion]() {
+				// Completion is reported on every path, a build that throws is rethrown by the getters
+				Result result;
+				try {
+					result = build(context, source, devices, options);
+				}
+				catch (...) {
+					if (on_completion) {
+						on_completion();
+					}
+					throw;
+				}
+				if (on_completion) {
+					on_completion();
+				}
+				return result;
+			}).share();
+		}
+
+		bool isReady() const
+		{
+			return m_result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		}
+
+		void wait() const
+		{
+			m_result.wait();
+		}
+
+		bool waitFor(std::chrono::milliseconds timeout) const
+		{
+			return m_result.wait_for(timeout) == std::future_status::ready;
 		}
 
-		void setArgument(uint32_t arg_num, MemoryObject& object)
+		bool succeeded() const
 		{
-			std::stringstream ssx;
-			ssx << "Cannot set argument [" << arg_num << "] of kernel '" << m_name << "'";
-			Utils::checkError(clSetKernelArg(m_kernel, arg_num, sizeof(cl_mem), &(object.getRaw())), ssx.str());
+			return m_result.get().err_num == CL_SUCCESS;
 		}
 
-		void setArgument(uint32_t arg_num, Image& object)
+		// Waits for the build, throws if it failed
+		Program getProgram() const
 		{
-			std::stringstream ssx;
-			ssx << "Cannot set argument [" << arg_num << "] of kernel '" << m_name << "'";
-			Utils::checkError(clSetKernelArg(m_kernel, arg_num, sizeof(cl_mem), &(object.getRaw())), ssx.str());
+			const Result& result = m_result.get();
+			if (result.err_num != CL_SUCCESS) {
+				std::string logs;
+				for (const BuildLog& log : result.logs) {
+					logs += log.log;
+				}
+				Utils::checkError(result.err_num, "Cannot build program: '" + logs + "'");
+			}
+			return result.program;
 		}
 
-		template<typename T>
-		void setArgument(uint32_t arg_num, const T& arg_value)
+		const std::vector<BuildLog>& getLogs() const
 		{
-			std::stringstream ssx;
-			ssx << "Cannot set argument [" << arg_num << "] of kernel '" << m_name << "'";
-			Utils::checkError(clSetKernelArg(m_kernel, arg_num, sizeof(T), &arg_value), ssx.str());
+			return m_result.get().logs;
 		}
 
-		Kernel& operator=(const Kernel& other)
+		// Build duration in milliseconds
+		double getBuildTime() const
 		{
-			m_name = other.m_name;
-			m_kernel = other.m_kernel;
-			Utils::checkError(clRetainKernel(m_kernel), "Cannot retain kernel");
-			return *this;
+			return m_result.get().build_time;
 		}
 
-		~Kernel()
+	private:
+		struct Result
 		{
-			if (m_kernel) {
-				clReleaseKernel(m_kernel);
+			Program program;
+			cl_int err_num;
+			std::vector<BuildLog> logs;
+			double build_time;
+		};
+
+		std::shared_future<Result> m_result;
+
+		static Result build(cl_context context, const std::string& source, const std::vector<cl_device_id>& devices, const std::string& options)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			Result result;
+			const char *src_str = source.c_str();
+			const cl_program program = clCreateProgramWithSource(context, 1, (const char**)&src_str, NULL, &result.err_num);
+			if (result.err_num == CL_SUCCESS) {
+				result.program = Program(program);
+				result.err_num = clBuildProgram(program, static_cast<cl_uint>(devices.size()), devices.empty() ? NULL : devices.data(), options.c_str(), NULL, NULL);
+				result.logs = Program::getBuildLogs(program);
+				if (result.err_num == CL_SUCCESS) {
+					if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+						capture->recordBuildProgram(program, source, options);
+					}
+				}
 			}
+			result.build_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return result;
 		}
+	};
 
-		cl_kernel& getRaw()
+
+	// Starts builds in parallel and hands them back in completion order
+	class ProgramBuildQueue
+	{
+	public:
+		ProgramBuildQueue(cl_context context, const std::vector<cl_device_id>& devices = {})
+			: m_context(context)
+			, m_devices(devices)
+			, m_state(std::make_shared<State>())
+			, m_returned_count(0u)
+		{}
+
+		void add(const std::string& name, const std::string& source, const std::string& options = "")
 		{
-			return m_kernel;
+			const std::size_t index = m_builds.size();
+			std::shared_ptr<State> state = m_state;
+			m_names.push_back(name);
+			m_builds.emplace_back(m_context, source, m_devices, options, [state, index]() {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->completed.push_back(index);
+				state->condition.notify_one();
+			});
 		}
 
-		const std::string& getName() const
+		// Blocks until a build that wasn't returned yet completes, returns false once all builds have been returned
+		bool next(std::string& name, ProgramBuild& build)
 		{
-			return m_name;
+			if (m_returned_count == m_builds.size()) {
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(m_state->mutex);
+			m_state->condition.wait(lock, [this]() { return !m_state->completed.empty(); });
+			const std::size_t index = m_state->completed.front();
+			m_state->completed.pop_front();
+			++m_returned_count;
+			name = m_names[index];
+			build = m_builds[index];
+			return true;
+		}
+
+		std::size_t getPendingCount() const
+		{
+			return m_builds.size() - m_returned_count;
 		}
 
 	private:
-		cl_kernel m_kernel;
-		std::string m_name;
+		struct State
+		{
+			std::mutex mutex;
+			std::condition_variable condition;
+			std::deque<std::size_t> completed;
+		};
+
+		cl_context m_context;
+		std::vector<cl_device_id> m_devices;
+		std::shared_ptr<State> m_state;
+		std::vector<std::string> m_names;
+		std::vector<ProgramBuild> m_builds;
+		std::size_t m_returned_count;
 	};
 
 
-	class Program
+	// Owns a reference to a cl_event, user events are completed from the host with setComplete
+	class Event
 	{
 	public:
-		Program(cl_program program = nullptr)
-			: m_program(program)
+		Event(cl_event raw_event = nullptr)
+			: m_event(raw_event)
 		{}
 
-		Program(cl_context context, const std::string& source, cl_device_id device)
-			: m_program(nullptr)
+		Event(const Event& other)
+			: m_event(other.m_event)
 		{
-			int32_t err_num;
-			const char *src_str = source.c_str();
-			m_program = clCreateProgramWithSource(context, 1, (const char**)&src_str, NULL, &err_num);
-			Utils::checkError(err_num, "Cannot create program");
-
-			err_num = clBuildProgram(m_program, 0, NULL, NULL, NULL, NULL);
-			if (err_num != CL_SUCCESS) {
-				// Determine the reason for the error
-				char buildLog[32000];
-				clGetProgramBuildInfo(m_program, device, CL_PROGRAM_BUILD_LOG, sizeof(buildLog), buildLog, NULL);
-				clReleaseProgram(m_program);
-				Utils::checkError(err_num, "Cannot build program: '" + std::string(buildLog) + "'");
+			if (m_event) {
+				Utils::checkError(clRetainEvent(m_event), "Cannot retain event");
 			}
 		}
 
-		Program& operator=(const Program& other)
+		Event& operator=(const Event& other)
 		{
-			m_program = other.m_program;
-			Utils::checkError(clRetainProgram(m_program), "Cannot retain program");
+			if (this == &other) {
+				return *this;
+			}
+			if (m_event) {
+				clReleaseEvent(m_event);
+			}
+			m_event = other.m_event;
+			if (m_event) {
+				Utils::checkError(clRetainEvent(m_event), "Cannot retain event");
+			}
 			return *this;
 		}
 
-		~Program()
+		~Event()
 		{
-			if (m_program) {
-				clReleaseProgram(m_program);
+			if (m_event) {
+				clReleaseEvent(m_event);
 			}
 		}
 
+		static Event createUserEvent(cl_context context)
+		{
+			cl_int err_num;
+			const cl_event event = clCreateUserEvent(context, &err_num);
+			Utils::checkError(err_num, "Cannot create user event");
+			return Event(event);
+		}
+
 		operator bool() const
 		{
-			return m_program;
+			return m_event;
 		}
 
-		Kernel createKernel(const std::string& kernel_name)
+		const cl_event& getRaw() const
 		{
-			return Kernel(m_program, kernel_name);
+			return m_event;
+		}
+
+		void wait() const
+		{
+			Utils::checkError(clWaitForEvents(1, &m_event), "Error while waiting for event");
+		}
+
+		bool isComplete() const
+		{
+			cl_int status;
+			Utils::checkError(clGetEventInfo(m_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL), "Cannot get event status");
+			// Failed commands report a negative status, they are complete as well
+			return status <= CL_COMPLETE;
+		}
+
+		// A negative error code aborts the commands waiting for this event
+		void setComplete(cl_int status = CL_COMPLETE)
+		{
+			Utils::checkError(clSetUserEventStatus(m_event, status), "Cannot set user event status");
 		}
 
 	private:
-		cl_program m_program;
+		cl_event m_event;
 	};
 
 
@@ -471,10 +1647,26 @@ namespace oclw
 			Utils::checkError(err_num, "Cannot create command queue");
 		}
 
+		CommandQueue(const CommandQueue& other)
+			: m_command_queue(other.m_command_queue)
+		{
+			if (m_command_queue) {
+				Utils::checkError(clRetainCommandQueue(m_command_queue), "Cannot retain command queue");
+			}
+		}
+
 		CommandQueue& operator=(const CommandQueue& other)
 		{
+			if (this == &other) {
+				return *this;
+			}
+			if (m_command_queue) {
+				clReleaseCommandQueue(m_command_queue);
+			}
 			m_command_queue = other.m_command_queue;
-			Utils::checkError(clRetainCommandQueue(m_command_queue), "Cannot retain command queue");
+			if (m_command_queue) {
+				Utils::checkError(clRetainCommandQueue(m_command_queue), "Cannot retain command queue");
+			}
 			return *this;
 		}
 
@@ -494,6 +1686,22 @@ namespace oclw
 		{
 			const int32_t err_num = clEnqueueNDRangeKernel(m_command_queue, kernel.getRaw(), work_dimension, global_work_offset, global_work_size, local_work_size, 0, 0, 0);
 			Utils::checkError(err_num, "Cannot add kernel '" + kernel.getName() + "' to command queue");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordRunKernel(kernel.getRaw(), work_dimension, global_work_offset, global_work_size, local_work_size);
+			}
+		}
+
+		// Non blocking, the returned event completes with the kernel
+		Event addKernel(Kernel& kernel, uint32_t work_dimension, const std::size_t* global_work_offset, const size_t* global_work_size, const size_t* local_work_size, const std::vector<Event>& wait_list)
+		{
+			cl_event event;
+			const std::vector<cl_event> raw_wait_list = getRawEvents(wait_list);
+			const int32_t err_num = clEnqueueNDRangeKernel(m_command_queue, kernel.getRaw(), work_dimension, global_work_offset, global_work_size, local_work_size, static_cast<cl_uint>(raw_wait_list.size()), raw_wait_list.empty() ? NULL : raw_wait_list.data(), &event);
+			Utils::checkError(err_num, "Cannot add kernel '" + kernel.getName() + "' to command queue");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordRunKernel(kernel.getRaw(), work_dimension, global_work_offset, global_work_size, local_work_size);
+			}
+			return Event(event);
 		}
 
 		template<typename T>
@@ -501,6 +1709,31 @@ namespace oclw
 		{
 			int32_t err_num = clEnqueueReadBuffer(m_command_queue, object.getRaw(), blocking_read ? CL_TRUE : CL_FALSE, 0, object.getBytesSize(), result.data(), 0, NULL, NULL);
 			Utils::checkError(err_num, "Cannot read from buffer");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordReadBuffer(object.getRaw(), 0u, object.getBytesSize());
+			}
+		}
+
+		void readMemoryObject(MemoryObject& object, bool blocking_read, void* result, std::size_t bytes_size, std::size_t offset = 0u)
+		{
+			int32_t err_num = clEnqueueReadBuffer(m_command_queue, object.getRaw(), blocking_read ? CL_TRUE : CL_FALSE, offset, bytes_size, result, 0, NULL, NULL);
+			Utils::checkError(err_num, "Cannot read from buffer");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordReadBuffer(object.getRaw(), offset, bytes_size);
+			}
+		}
+
+		// Non blocking, result must stay valid until the returned event completes
+		Event readMemoryObject(MemoryObject& object, void* result, std::size_t bytes_size, std::size_t offset, const std::vector<Event>& wait_list)
+		{
+			cl_event event;
+			const std::vector<cl_event> raw_wait_list = getRawEvents(wait_list);
+			int32_t err_num = clEnqueueReadBuffer(m_command_queue, object.getRaw(), CL_FALSE, offset, bytes_size, result, static_cast<cl_uint>(raw_wait_list.size()), raw_wait_list.empty() ? NULL : raw_wait_list.data(), &event);
+			Utils::checkError(err_num, "Cannot read from buffer");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordReadBuffer(object.getRaw(), offset, bytes_size);
+			}
+			return Event(event);
 		}
 
 		template<typename T>
@@ -511,6 +1744,9 @@ namespace oclw
 			const bool blocking = blocking_read ? CL_TRUE : CL_FALSE;
 			int32_t err_num = clEnqueueReadImage(m_command_queue, image.getRaw(), blocking, origin, region, 0, 0, result.data(), 0, NULL, NULL);
 			Utils::checkError(err_num, "Cannot read from image");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordReadImage(image.getRaw(), image.getWidth(), image.getHeight());
+			}
 		}
 
 		template<typename T>
@@ -518,15 +1754,67 @@ namespace oclw
 		{
 			const cl_int err_num = clEnqueueWriteBuffer(m_command_queue, object.getRaw(), CL_TRUE, 0, object.getBytesSize(), data, 0, NULL, NULL);
 			Utils::checkError(err_num, "Cannot write in buffer");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordWriteBuffer(object.getRaw(), 0u, object.getBytesSize(), data);
+			}
+		}
+
+		void writeInMemoryObject(MemoryObject& object, bool blocking_write, const void* data, std::size_t bytes_size, std::size_t offset = 0u)
+		{
+			const cl_int err_num = clEnqueueWriteBuffer(m_command_queue, object.getRaw(), blocking_write ? CL_TRUE : CL_FALSE, offset, bytes_size, data, 0, NULL, NULL);
+			Utils::checkError(err_num, "Cannot write in buffer");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordWriteBuffer(object.getRaw(), offset, bytes_size, data);
+			}
+		}
+
+		// Non blocking, data must stay valid until the returned event completes
+		Event writeInMemoryObject(MemoryObject& object, const void* data, std::size_t bytes_size, std::size_t offset, const std::vector<Event>& wait_list)
+		{
+			cl_event event;
+			const std::vector<cl_event> raw_wait_list = getRawEvents(wait_list);
+			const cl_int err_num = clEnqueueWriteBuffer(m_command_queue, object.getRaw(), CL_FALSE, offset, bytes_size, data, static_cast<cl_uint>(raw_wait_list.size()), raw_wait_list.empty() ? NULL : raw_wait_list.data(), &event);
+			Utils::checkError(err_num, "Cannot write in buffer");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordWriteBuffer(object.getRaw(), offset, bytes_size, data);
+			}
+			return Event(event);
+		}
+
+		// Moves the object to this queue's device, its content is kept unless content_undefined is set
+		void migrateMemoryObject(MemoryObject& object, bool content_undefined = false)
+		{
+			const cl_mem_migration_flags flags = content_undefined ? CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED : 0;
+			const cl_int err_num = clEnqueueMigrateMemObjects(m_command_queue, 1, &object.getRaw(), flags, 0, NULL, NULL);
+			Utils::checkError(err_num, "Cannot migrate memory object");
 		}
 
 		void waitCompletion()
 		{
 			clFinish(m_command_queue);
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordFinish();
+			}
+		}
+
+		// Submits queued commands to the device without waiting for them
+		void flush()
+		{
+			Utils::checkError(clFlush(m_command_queue), "Cannot flush command queue");
 		}
 
 	private:
 		cl_command_queue m_command_queue;
+
+		static std::vector<cl_event> getRawEvents(const std::vector<Event>& events)
+		{
+			std::vector<cl_event> raw_events;
+			raw_events.reserve(events.size());
+			for (const Event& event : events) {
+				raw_events.push_back(event.getRaw());
+			}
+			return raw_events;
+		}
 	};
 
 
@@ -640,6 +1928,9 @@ namespace oclw
 			cl_int err_num;
 			const cl_mem image = clCreateImage(m_context, mode, &image_format, &image_desc, data, &err_num);
 			Utils::checkError(err_num, "Cannot create 2D image");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordCreateImage(image, mode, CL_MEM_OBJECT_IMAGE2D, image_format, width, height, 1u);
+			}
 			return Image(image, width, height, 4u);
 		}
 
@@ -657,6 +1948,9 @@ namespace oclw
 			cl_int err_num;
 			const cl_mem image = clCreateImage(m_context, mode, &image_format, &image_desc, data, &err_num);
 			Utils::checkError(err_num, "Cannot create 3D image");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordCreateImage(image, mode, CL_MEM_OBJECT_IMAGE3D, image_format, width, height, depth);
+			}
 			return MemoryObject(image, width * height, 4u);
 		}
 
@@ -673,6 +1967,9 @@ namespace oclw
 			cl_int err_num;
 			cl_mem image = clCreateImage(m_context, MemoryObjectMode::ReadWrite, &image_format, &image_desc, nullptr, &err_num);
 			Utils::checkError(err_num, "Cannot create 3D image");
+			if (std::shared_ptr<Capture> capture = Capture::getActive()) {
+				capture->recordCreateImage(image, MemoryObjectMode::ReadWrite, CL_MEM_OBJECT_IMAGE3D, image_format, width, height, depth);
+			}
 			return MemoryObject(image, width * height, 4u);
 		}
 
@@ -681,6 +1978,101 @@ namespace oclw
 	};
 
 
+	/*
+	A partition of a device (typically a NUMA node of a CPU device) with its own command queue.
+	Programs are built for the sub-device only and memory objects created through it are
+	migrated to it and first touched through its queue, so data stays local to its cores.
+	Partitions share a context created over them, distinct from the wrapper's one, so kernels
+	and memory objects of a sub-device can't be mixed with the wrapper's.
+	*/
+	class SubDevice
+	{
+	public:
+		// The context must have been created with the sub-device, both are released with the last copy
+		SubDevice(const std::shared_ptr<_cl_context>& context, const std::shared_ptr<_cl_device_id>& device)
+			: m_context(context)
+			, m_device(device)
+			, m_command_queue(context.get(), device.get())
+		{}
+
+		cl_device_id getRaw() const
+		{
+			return m_device.get();
+		}
+
+		cl_context getContext() const
+		{
+			return m_context.get();
+		}
+
+		uint32_t getComputeUnitsCount() const
+		{
+			return Utils::getDeviceInfo<cl_uint>(m_device.get(), CL_DEVICE_MAX_COMPUTE_UNITS);
+		}
+
+		CommandQueue& getCommandQueue()
+		{
+			return m_command_queue;
+		}
+
+		Program createProgram(const std::string& source, const std::string& options = "")
+		{
+			return Program(m_context.get(), source, std::vector<cl_device_id>{ m_device.get() }, options);
+		}
+
+		Program createProgramFromFile(const std::string& filename, const std::string& options = "")
+		{
+			return createProgram(Utils::loadSourceFromFile(filename), options);
+		}
+
+		template<typename T>
+		MemoryObject createMemoryObject(std::vector<T>& data, int32_t mode = oclw::ReadWrite)
+		{
+			MemoryObject object = createMemoryObject<T>(data.size(), mode & ~CopyHostPtr);
+			m_command_queue.writeInMemoryObject(object, true, data.data(), object.getBytesSize());
+			return object;
+		}
+
+		template<typename T>
+		MemoryObject createMemoryObject(std::size_t element_count, int32_t mode = oclw::ReadWrite)
+		{
+			MemoryObject object(m_context.get(), sizeof(T), element_count, mode);
+			m_command_queue.migrateMemoryObject(object, true);
+			return object;
+		}
+
+		void runKernel(Kernel& kernel, const Size& global_size, const Size& local_size, const std::size_t* global_work_offset = nullptr)
+		{
+			m_command_queue.addKernel(kernel, global_size.dimension, global_work_offset, global_size.sizes, local_size.sizes);
+			m_command_queue.waitCompletion();
+		}
+
+		void runKernel(Kernel& kernel, const Size& global_size, const std::size_t* global_work_offset = nullptr)
+		{
+			m_command_queue.addKernel(kernel, global_size.dimension, global_work_offset, global_size.sizes, nullptr);
+			m_command_queue.waitCompletion();
+		}
+
+		template<typename T>
+		void readMemoryObject(MemoryObject& mem_object, std::vector<T>& result_container, bool blocking_read = true)
+		{
+			result_container.resize(mem_object.getSize());
+			m_command_queue.readMemoryObject(mem_object, blocking_read, result_container);
+		}
+
+		template<typename T>
+		void writeInMemoryObject(MemoryObject& object, const std::vector<T>& data, bool blocking_write)
+		{
+			m_command_queue.writeInMemoryObject(object, blocking_write, data.data(), data.size() * sizeof(T));
+		}
+
+	private:
+		std::shared_ptr<_cl_context> m_context;
+		std::shared_ptr<_cl_device_id> m_device;
+		CommandQueue m_command_queue;
+	};
+
+
 	class Wrapper
 	{
 	public:
@@ -691,6 +2083,11 @@ namespace oclw
 			initializeContext(type);
 		}
 
+		~Wrapper()
+		{
+			stopCapture();
+		}
+
 		std::vector<cl_platform_id> getPlatforms(const uint32_t num, cl_uint* platforms_count = nullptr)
 		{
 			std::vector<cl_platform_id> platforms(num);
@@ -709,23 +2106,52 @@ namespace oclw
 			return m_context.createProgram(m_device, filename);
 		}
 
-		Program createProgram(const std::string& source)
+		Program createProgram(const std::string& source, const std::string& options = "")
 		{
-			return Program(m_context, source, m_device);
+			return Program(m_context, source, m_device, options);
+		}
+
+		// Builds on a worker thread for all the context's devices
+		ProgramBuild createProgramAsync(const std::string& source, const std::string& options = "")
+		{
+			return ProgramBuild(m_context, source, {}, options);
+		}
+
+		ProgramBuildQueue createProgramBuildQueue()
+		{
+			return ProgramBuildQueue(m_context);
 		}
 
 		void runKernel(Kernel& kernel, const Size& global_size, const Size& local_size, const std::size_t* global_work_offset = nullptr)
 		{
+			if (m_occupancy_warnings) {
+				const OccupancyReport report = kernel.getOccupancyReport(m_device, global_size, local_size);
+				for (const std::string& warning : report.warnings) {
+					std::cout << "Kernel '" << kernel.getName() << "': " << warning << std::endl;
+				}
+			}
 			m_command_queue.addKernel(kernel, global_size.dimension, global_work_offset, global_size.sizes, local_size.sizes);
 			m_command_queue.waitCompletion();
 		}
 
+		void runKernel(Kernel& kernel, const Size& global_size, const std::size_t* global_work_offset = nullptr)
+		{
+			// Let the implementation pick the work-group size
+			m_command_queue.addKernel(kernel, global_size.dimension, global_work_offset, global_size.sizes, nullptr);
+			m_command_queue.waitCompletion();
+		}
+
 		template<typename T>
 		void readMemoryObject(MemoryObject& mem_object, std::vector<T>& result_container, bool blocking_read = true)
 		{
 			m_command_queue.readMemoryObject(mem_object, blocking_read, result_container);
 		}
 
+		void readMemoryObject(MemoryObject& mem_object, void* result, std::size_t bytes_size, bool blocking_read = true, std::size_t offset = 0u)
+		{
+			m_command_queue.readMemoryObject(mem_object, blocking_read, result, bytes_size, offset);
+		}
+
 		template<typename T>
 		void readImageObject(Image& image, std::vector<T>& result_container, bool blocking_read = true)
 		{
@@ -747,6 +2173,65 @@ namespace oclw
 			return m_context;
 		}
 
+		std::vector<SubDevice> createSubDevicesEqually(uint32_t compute_units)
+		{
+			return createSubDevices({ CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(compute_units), 0 });
+		}
+
+		std::vector<SubDevice> createSubDevicesByCounts(const std::vector<uint32_t>& compute_units)
+		{
+			std::vector<cl_device_partition_property> properties{ CL_DEVICE_PARTITION_BY_COUNTS };
+			for (uint32_t count : compute_units) {
+				properties.push_back(static_cast<cl_device_partition_property>(count));
+			}
+			properties.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
+			properties.push_back(0);
+			return createSubDevices(properties);
+		}
+
+		std::vector<SubDevice> createSubDevicesByAffinity(AffinityDomain domain = AffinityDomain::NUMA)
+		{
+			return createSubDevices({ CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, static_cast<cl_device_partition_property>(domain), 0 });
+		}
+
+		OccupancyReport getOccupancyReport(const Kernel& kernel, const Size& global_size, const Size& local_size) const
+		{
+			return kernel.getOccupancyReport(m_device, global_size, local_size);
+		}
+
+		// When enabled, launches with an explicit local size print their occupancy warnings
+		void setOccupancyWarnings(bool enabled)
+		{
+			m_occupancy_warnings = enabled;
+		}
+
+		CommandQueue& getCommandQueue()
+		{
+			return m_command_queue;
+		}
+
+		cl_device_id getDevice() const
+		{
+			return m_device;
+		}
+
+		// Records every following wrapper call in a binary file that can be replayed with opencl_wrapper_replay
+		void startCapture(const std::string& filename, bool with_data = false)
+		{
+			stopCapture();
+			m_capture = std::make_shared<Capture>(filename, with_data);
+			Capture::setActive(m_capture);
+		}
+
+		// The file is closed once records in flight on other threads are done
+		void stopCapture()
+		{
+			if (m_capture) {
+				Capture::clearActive(m_capture.get());
+			}
+			m_capture.reset();
+		}
+
 		template<typename T>
 		MemoryObject createMemoryObject(std::vector<T>& data, int32_t mode = oclw::ReadWrite)
 		{
@@ -771,6 +2256,11 @@ namespace oclw
 			m_command_queue.writeInMemoryObject(object, blocking_write, data.data());
 		}
 
+		void writeInMemoryObject(MemoryObject& object, const void* data, std::size_t bytes_size, bool blocking_write, std::size_t offset = 0u)
+		{
+			m_command_queue.writeInMemoryObject(object, blocking_write, data, bytes_size, offset);
+		}
+
 		oclw::CommandQueue createCommandQueue()
 		{
 			if (m_context) {
@@ -789,6 +2279,8 @@ namespace oclw
 		Context m_context;
 		cl_device_id m_device;
 		CommandQueue m_command_queue;
+		std::shared_ptr<Capture> m_capture;
+		bool m_occupancy_warnings = false;
 
 		void initializeContext(DeviceType type)
 		{
@@ -810,6 +2302,38 @@ namespace oclw
 			}
 		}
 
+		std::vector<SubDevice> createSubDevices(const std::vector<cl_device_partition_property>& properties)
+		{
+			cl_uint devices_count = 0;
+			cl_int err_num = clCreateSubDevices(m_device, properties.data(), 0, NULL, &devices_count);
+			Utils::checkError(err_num, "Cannot partition device");
+
+			std::vector<cl_device_id> raw_devices(devices_count);
+			std::vector<std::shared_ptr<_cl_device_id>> devices;
+			devices.reserve(devices_count);
+			err_num = clCreateSubDevices(m_device, properties.data(), devices_count, raw_devices.data(), NULL);
+			Utils::checkError(err_num, "Cannot partition device");
+			// Owned right away so they are released if anything below throws
+			for (cl_device_id device : raw_devices) {
+				devices.emplace_back(device, clReleaseDevice);
+			}
+
+			// Queues, builds and allocations on a sub-device need a context that contains it
+			const cl_context_properties context_properties[] = {
+				CL_CONTEXT_PLATFORM, (cl_context_properties)Utils::getDeviceInfo<cl_platform_id>(m_device, CL_DEVICE_PLATFORM), 0
+			};
+			const cl_context raw_context = clCreateContext(context_properties, devices_count, raw_devices.data(), NULL, NULL, &err_num);
+			Utils::checkError(err_num, "Cannot create sub-devices context");
+			const std::shared_ptr<_cl_context> context(raw_context, clReleaseContext);
+
+			std::vector<SubDevice> sub_devices;
+			sub_devices.reserve(devices_count);
+			for (const std::shared_ptr<_cl_device_id>& device : devices) {
+				sub_devices.emplace_back(context, device);
+			}
+			return sub_devices;
+		}
+
 		void initializeCommandQueue()
 		{
 			if (m_context) {
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <CL/opencl.h>
+#include <ocl_half.hpp>
+
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void benchAccuracy()
+{
+	// Log-uniform magnitudes over the normal half range
+	std::mt19937 generator(0u);
+	std::uniform_real_distribution<float> exponent(-14.0f, 15.9f);
+	std::bernoulli_distribution negative(0.5);
+	const std::size_t count = 1u << 20u;
+	std::vector<float> values(count);
+	for (float& value : values) {
+		value = std::exp2(exponent(generator)) * (negative(generator) ? -1.0f : 1.0f);
+	}
+
+	std::vector<uint16_t> halves(count);
+	std::vector<float> result(count);
+	oclw::HalfConverter::compress(values.data(), halves.data(), count);
+	oclw::HalfConverter::expand(halves.data(), result.data(), count);
+
+	double max_relative_error = 0.0;
+	double mean_relative_error = 0.0;
+	for (std::size_t i(0); i < count; ++i) {
+		const double relative_error = std::abs(static_cast<double>(result[i]) - values[i]) / std::abs(values[i]);
+		max_relative_error = std::max(max_relative_error, relative_error);
+		mean_relative_error += relative_error;
+	}
+	std::cout << "Accuracy over " << count << " values in [2^-14, 65504]" << std::endl;
+	std::cout << "  max relative error  " << max_relative_error << " (bound " << std::exp2(-11.0) << ")" << std::endl;
+	std::cout << "  mean relative error " << mean_relative_error / count << std::endl;
+}
+
+
+void benchHostConversion(std::size_t count)
+{
+	std::vector<float> values(count, 1.5f);
+	std::vector<uint16_t> halves(count);
+	auto start = std::chrono::steady_clock::now();
+	oclw::HalfConverter::compress(values.data(), halves.data(), count);
+	const double compress_ms = elapsedMs(start);
+	start = std::chrono::steady_clock::now();
+	oclw::HalfConverter::expand(halves.data(), values.data(), count);
+	const double expand_ms = elapsedMs(start);
+
+	const double gb = count * sizeof(float) / 1e9;
+	std::cout << "Host conversion of " << count << " values" << std::endl;
+	std::cout << "  compress " << compress_ms << " ms (" << gb / (compress_ms / 1e3) << " GB/s of float32)" << std::endl;
+	std::cout << "  expand   " << expand_ms << " ms (" << gb / (expand_ms / 1e3) << " GB/s of float32)" << std::endl;
+}
+
+
+void benchTransfers(oclw::Wrapper& wrapper, std::size_t count, uint32_t iterations)
+{
+	std::vector<float> values(count, 0.25f);
+	std::vector<float> result(count);
+	oclw::MemoryObject buffer = wrapper.createMemoryObject<float>(count, oclw::ReadWrite);
+	oclw::HalfTransfer half_transfer(wrapper);
+
+	// Warm up, builds the conversion program and allocates staging buffers
+	half_transfer.write(buffer, values);
+	half_transfer.read(buffer, result);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i(0); i < iterations; ++i) {
+		wrapper.writeInMemoryObject(buffer, values, true);
+		wrapper.readMemoryObject(buffer, result);
+	}
+	const double full_ms = elapsedMs(start) / iterations;
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i(0); i < iterations; ++i) {
+		half_transfer.write(buffer, values);
+		half_transfer.read(buffer, result);
+	}
+	const double half_ms = elapsedMs(start) / iterations;
+
+	const double gb = 2.0 * count * sizeof(float) / 1e9;
+	std::cout << "Upload + download of " << count << " floats" << std::endl;
+	std::cout << "  float32 " << full_ms << " ms (" << gb / (full_ms / 1e3) << " GB/s effective)" << std::endl;
+	std::cout << "  fp16    " << half_ms << " ms (" << gb / (half_ms / 1e3) << " GB/s effective)" << std::endl;
+	std::cout << "  speedup " << full_ms / half_ms << "x" << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		const std::string device = argc > 1 ? argv[1] : "gpu";
+		const std::size_t count = 1u << 24u;
+
+		benchAccuracy();
+		benchHostConversion(count);
+
+		oclw::Wrapper wrapper(device == "cpu" ? oclw::DeviceType::CPU : oclw::DeviceType::GPU);
+		benchTransfers(wrapper, count, 10u);
+	}
+	catch (const oclw::Exception& error)
+	{
+		std::cout << "Error: " << error.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
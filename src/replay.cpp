@@ -0,0 +1,310 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <map>
+#include <CL/opencl.h>
+#include <ocl_wrapper.hpp>
+
+
+class CaptureReader
+{
+public:
+	CaptureReader(const std::string& filename)
+		: m_file(filename, std::ios::in | std::ios::binary)
+	{
+		if (!m_file.is_open()) {
+			throw oclw::Exception(-1, "Cannot open capture file '" + filename + "'");
+		}
+		if (read<uint32_t>() != oclw::Capture::Magic) {
+			throw oclw::Exception(-1, "'" + filename + "' is not a capture file");
+		}
+		if (read<uint32_t>() != oclw::Capture::Version) {
+			throw oclw::Exception(-1, "Unsupported capture version in '" + filename + "'");
+		}
+	}
+
+	bool readOperation(oclw::CaptureOperation& operation)
+	{
+		uint8_t raw_operation;
+		if (!m_file.read(reinterpret_cast<char*>(&raw_operation), 1)) {
+			return false;
+		}
+		operation = static_cast<oclw::CaptureOperation>(raw_operation);
+		return true;
+	}
+
+	template<typename T>
+	T read()
+	{
+		T value;
+		if (!m_file.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+			throw oclw::Exception(-1, "Truncated capture file");
+		}
+		return value;
+	}
+
+	std::string readString()
+	{
+		std::string str(read<uint32_t>(), '\0');
+		readBytes(&str[0], str.size());
+		return str;
+	}
+
+	// Returns false if the data wasn't captured
+	bool readData(std::vector<uint8_t>& data, uint64_t bytes_size)
+	{
+		data.resize(bytes_size);
+		if (read<uint8_t>()) {
+			readBytes(data.data(), bytes_size);
+			return true;
+		}
+		return false;
+	}
+
+	bool readSizes(std::size_t* sizes, uint32_t dimension)
+	{
+		sizes[0] = sizes[1] = sizes[2] = 0u;
+		if (!read<uint8_t>()) {
+			return false;
+		}
+		for (uint32_t i(0); i < dimension; ++i) {
+			sizes[i] = static_cast<std::size_t>(read<uint64_t>());
+		}
+		return true;
+	}
+
+private:
+	std::ifstream m_file;
+
+	void readBytes(void* destination, uint64_t bytes_size)
+	{
+		if (!m_file.read(static_cast<char*>(destination), bytes_size)) {
+			throw oclw::Exception(-1, "Truncated capture file");
+		}
+	}
+};
+
+
+struct OperationStats
+{
+	uint64_t count = 0u;
+	double total_us = 0.0;
+};
+
+
+class Replayer
+{
+public:
+	Replayer(oclw::Wrapper& wrapper)
+		: m_wrapper(wrapper)
+	{}
+
+	void run(CaptureReader& reader)
+	{
+		oclw::CaptureOperation operation;
+		uint64_t index = 0u;
+		while (reader.readOperation(operation)) {
+			std::string detail;
+			const auto start = std::chrono::steady_clock::now();
+			const std::string name = execute(reader, operation, detail);
+			const double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+			std::cout << "#" << index++ << " " << std::left << std::setw(18) << name << std::setw(40) << detail << std::right << std::fixed << std::setprecision(1) << elapsed_us << " us" << std::endl;
+			OperationStats& stats = m_stats[name];
+			++stats.count;
+			stats.total_us += elapsed_us;
+		}
+
+		std::cout << std::endl << "Summary" << std::endl;
+		for (const auto& entry : m_stats) {
+			const OperationStats& stats = entry.second;
+			std::cout << std::left << std::setw(18) << entry.first << std::right << std::setw(8) << stats.count << " ops "
+				<< std::setw(14) << stats.total_us << " us total " << std::setw(12) << stats.total_us / stats.count << " us mean" << std::endl;
+		}
+	}
+
+private:
+	oclw::Wrapper& m_wrapper;
+	std::map<uint64_t, oclw::Program> m_programs;
+	std::map<uint64_t, oclw::Kernel> m_kernels;
+	std::map<uint64_t, oclw::MemoryObject> m_buffers;
+	std::map<uint64_t, oclw::Image> m_images;
+	std::map<std::string, OperationStats> m_stats;
+	std::vector<uint8_t> m_scratch;
+
+	template<typename T>
+	static T& find(std::map<uint64_t, T>& objects, uint64_t id, const std::string& type)
+	{
+		auto it = objects.find(id);
+		if (it == objects.end()) {
+			throw oclw::Exception(-1, "Capture references unknown " + type);
+		}
+		return it->second;
+	}
+
+	// Releases aren't captured and drivers reuse handle addresses, a new object replaces any older one with the same id
+	void forget(uint64_t id)
+	{
+		m_programs.erase(id);
+		m_kernels.erase(id);
+		m_buffers.erase(id);
+		m_images.erase(id);
+	}
+
+	oclw::MemoryObject& findObject(uint64_t id)
+	{
+		auto it = m_images.find(id);
+		if (it != m_images.end()) {
+			return it->second;
+		}
+		return find(m_buffers, id, "memory object");
+	}
+
+	// Device operations are waited for so their timing includes execution
+	std::string execute(CaptureReader& reader, oclw::CaptureOperation operation, std::string& detail)
+	{
+		using oclw::CaptureOperation;
+		switch (operation) {
+		case CaptureOperation::BuildProgram: {
+			const uint64_t id = reader.read<uint64_t>();
+			forget(id);
+			const std::string source = reader.readString();
+			const std::string options = reader.readString();
+			m_programs[id] = m_wrapper.createProgram(source, options);
+			detail = std::to_string(source.size()) + " chars " + options;
+			return "BuildProgram";
+		}
+		case CaptureOperation::CreateKernel: {
+			const uint64_t id = reader.read<uint64_t>();
+			// Copied, forgetting the kernel id must not invalidate it
+			oclw::Program program = find(m_programs, reader.read<uint64_t>(), "program");
+			forget(id);
+			detail = reader.readString();
+			m_kernels[id] = program.createKernel(detail);
+			return "CreateKernel";
+		}
+		case CaptureOperation::CreateBuffer: {
+			const uint64_t id = reader.read<uint64_t>();
+			forget(id);
+			const int32_t flags = static_cast<int32_t>(reader.read<uint64_t>());
+			const uint64_t bytes_size = reader.read<uint64_t>();
+			if (reader.readData(m_scratch, bytes_size)) {
+				m_buffers[id] = m_wrapper.getContext().createMemoryObject(m_scratch, flags);
+			}
+			else {
+				const int32_t no_host_flags = flags & ~(CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR);
+				m_buffers[id] = m_wrapper.getContext().createMemoryObject<uint8_t>(bytes_size, no_host_flags);
+			}
+			detail = std::to_string(bytes_size) + " bytes";
+			return "CreateBuffer";
+		}
+		case CaptureOperation::CreateImage: {
+			const uint64_t id = reader.read<uint64_t>();
+			forget(id);
+			const int32_t flags = static_cast<int32_t>(reader.read<uint64_t>()) & ~(CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR);
+			const uint32_t type = reader.read<uint32_t>();
+			const oclw::ImageFormat format = static_cast<oclw::ImageFormat>(reader.read<uint32_t>());
+			const oclw::ChannelDatatype datatype = static_cast<oclw::ChannelDatatype>(reader.read<uint32_t>());
+			const uint32_t width = static_cast<uint32_t>(reader.read<uint64_t>());
+			const uint32_t height = static_cast<uint32_t>(reader.read<uint64_t>());
+			const uint32_t depth = static_cast<uint32_t>(reader.read<uint64_t>());
+			if (type == CL_MEM_OBJECT_IMAGE2D) {
+				m_images[id] = m_wrapper.getContext().createImage2D(width, height, nullptr, flags, format, datatype);
+			}
+			else {
+				m_buffers[id] = m_wrapper.getContext().createImage3D(width, height, depth, nullptr, flags, format, datatype);
+			}
+			detail = std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(depth);
+			return "CreateImage";
+		}
+		case CaptureOperation::WriteBuffer: {
+			oclw::MemoryObject& object = findObject(reader.read<uint64_t>());
+			const uint64_t offset = reader.read<uint64_t>();
+			const uint64_t bytes_size = reader.read<uint64_t>();
+			if (!reader.readData(m_scratch, bytes_size)) {
+				std::fill(m_scratch.begin(), m_scratch.end(), 0u);
+			}
+			m_wrapper.writeInMemoryObject(object, m_scratch.data(), bytes_size, true, offset);
+			detail = std::to_string(bytes_size) + " bytes";
+			return "WriteBuffer";
+		}
+		case CaptureOperation::ReadBuffer: {
+			oclw::MemoryObject& object = findObject(reader.read<uint64_t>());
+			const uint64_t offset = reader.read<uint64_t>();
+			const uint64_t bytes_size = reader.read<uint64_t>();
+			m_scratch.resize(bytes_size);
+			m_wrapper.readMemoryObject(object, m_scratch.data(), bytes_size, true, offset);
+			detail = std::to_string(bytes_size) + " bytes";
+			return "ReadBuffer";
+		}
+		case CaptureOperation::ReadImage: {
+			oclw::Image& image = find(m_images, reader.read<uint64_t>(), "image");
+			const uint64_t width = reader.read<uint64_t>();
+			const uint64_t height = reader.read<uint64_t>();
+			// Large enough for the widest format (4 float channels)
+			std::vector<float> pixels(width * height * 4u);
+			m_wrapper.readImageObject(image, pixels);
+			detail = std::to_string(width) + "x" + std::to_string(height);
+			return "ReadImage";
+		}
+		case CaptureOperation::SetArgumentObject: {
+			oclw::Kernel& kernel = find(m_kernels, reader.read<uint64_t>(), "kernel");
+			const uint32_t arg_num = reader.read<uint32_t>();
+			kernel.setArgument(arg_num, findObject(reader.read<uint64_t>()));
+			detail = kernel.getName() + "[" + std::to_string(arg_num) + "]";
+			return "SetArgument";
+		}
+		case CaptureOperation::SetArgumentValue: {
+			oclw::Kernel& kernel = find(m_kernels, reader.read<uint64_t>(), "kernel");
+			const uint32_t arg_num = reader.read<uint32_t>();
+			const uint64_t arg_size = reader.read<uint64_t>();
+			const bool has_value = reader.readData(m_scratch, arg_size);
+			kernel.setArgument(arg_num, arg_size, has_value ? m_scratch.data() : nullptr);
+			detail = kernel.getName() + "[" + std::to_string(arg_num) + "]";
+			return "SetArgument";
+		}
+		case CaptureOperation::RunKernel: {
+			oclw::Kernel& kernel = find(m_kernels, reader.read<uint64_t>(), "kernel");
+			const uint32_t dimension = reader.read<uint32_t>();
+			std::size_t offset[3], global_size[3], local_size[3];
+			const bool has_offset = reader.readSizes(offset, dimension);
+			reader.readSizes(global_size, dimension);
+			const bool has_local = reader.readSizes(local_size, dimension);
+			m_wrapper.getCommandQueue().addKernel(kernel, dimension, has_offset ? offset : nullptr, global_size, has_local ? local_size : nullptr);
+			m_wrapper.getCommandQueue().waitCompletion();
+			detail = kernel.getName() + " " + std::to_string(global_size[0] * std::max<std::size_t>(global_size[1], 1u) * std::max<std::size_t>(global_size[2], 1u)) + " items";
+			return "RunKernel";
+		}
+		case CaptureOperation::Finish:
+			m_wrapper.getCommandQueue().waitCompletion();
+			return "Finish";
+		default:
+			throw oclw::Exception(-1, "Unknown operation in capture file");
+		}
+	}
+};
+
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		std::cout << "Usage: " << argv[0] << " <capture_file> [cpu|gpu]" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		const std::string device = argc > 2 ? argv[2] : "cpu";
+		oclw::Wrapper wrapper(device == "gpu" ? oclw::DeviceType::GPU : oclw::DeviceType::CPU);
+		CaptureReader reader(argv[1]);
+		Replayer replayer(wrapper);
+		replayer.run(reader);
+	}
+	catch (const oclw::Exception& error)
+	{
+		std::cout << "Error: " << error.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}